@@ -0,0 +1,291 @@
+// ==============================================================================
+// FILE: BridgeDoorbell.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include "BridgeProtocol.h"
+#include <climits>
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #ifndef WIN32_LEAN_AND_MEAN
+  #define WIN32_LEAN_AND_MEAN
+ #endif
+ #include <windows.h>
+#elif JUCE_LINUX
+ #include <ctime>
+ #include <linux/futex.h>
+ #include <sys/syscall.h>
+ #include <unistd.h>
+#else
+ #include <cerrno>
+ #include <ctime>
+ #include <fcntl.h>
+ #include <semaphore.h>
+#endif
+
+#if JUCE_INTEL
+ #include <emmintrin.h>
+#endif
+
+namespace VST1Bridge {
+
+    inline void cpuRelax() noexcept
+    {
+       #if JUCE_INTEL
+        _mm_pause();
+       #elif JUCE_ARM && JUCE_MSVC
+        __yield();
+       #elif JUCE_ARM
+        __asm__ __volatile__("yield");
+       #endif
+    }
+
+    //==============================================================================
+    // Kernel sleep/wake backends. Each one must provide:
+    //   bool create(DoorbellState&, const juce::String& name)  (host side)
+    //   bool open(DoorbellState&, const juce::String& name)    (bridge side)
+    //   void close()
+    //   void wait(DoorbellState&, uint32_t expected, int timeoutMs)
+    //   void wake(DoorbellState&)
+    // wait() may return spuriously; Doorbell re-checks the sequence word.
+
+   #if JUCE_LINUX
+    // Shared (non-private) futex on the sequence word itself: nothing to name.
+    class FutexWaiter
+    {
+    public:
+        bool create(DoorbellState&, const juce::String&) { return true; }
+        bool open(DoorbellState&, const juce::String&) { return true; }
+        void close() {}
+
+        void wait(DoorbellState& state, uint32_t expected, int timeoutMs)
+        {
+            timespec timeout { timeoutMs / 1000, (timeoutMs % 1000) * 1000000L };
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state.sequence), FUTEX_WAIT,
+                expected, timeoutMs >= 0 ? &timeout : nullptr, nullptr, 0);
+        }
+
+        void wake(DoorbellState& state)
+        {
+            syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state.sequence), FUTEX_WAKE,
+                INT_MAX, nullptr, nullptr, 0);
+        }
+    };
+
+    using DoorbellWaiter = FutexWaiter;
+
+   #elif JUCE_WINDOWS
+    // WaitOnAddress is process-local, so cross-process wake-ups go through a named semaphore
+    class SemaphoreWaiter
+    {
+    public:
+        ~SemaphoreWaiter() { close(); }
+
+        bool create(DoorbellState&, const juce::String& name)
+        {
+            close();
+            semaphore = CreateSemaphoreW(nullptr, 0, LONG_MAX, ("Local\\" + name).toWideCharPointer());
+            return semaphore != nullptr;
+        }
+
+        bool open(DoorbellState&, const juce::String& name)
+        {
+            close();
+            semaphore = OpenSemaphoreW(SEMAPHORE_ALL_ACCESS, FALSE, ("Local\\" + name).toWideCharPointer());
+            return semaphore != nullptr;
+        }
+
+        void close()
+        {
+            if (semaphore != nullptr)
+                CloseHandle(semaphore);
+
+            semaphore = nullptr;
+        }
+
+        void wait(DoorbellState&, uint32_t, int timeoutMs)
+        {
+            WaitForSingleObject(semaphore, timeoutMs >= 0 ? (DWORD)timeoutMs : INFINITE);
+        }
+
+        void wake(DoorbellState&)
+        {
+            ReleaseSemaphore(semaphore, 1, nullptr);
+        }
+
+    private:
+        HANDLE semaphore = nullptr;
+    };
+
+    using DoorbellWaiter = SemaphoreWaiter;
+
+   #else
+    // Portable POSIX fallback (macOS has no public cross-process futex)
+    class PosixSemaphoreWaiter
+    {
+    public:
+        ~PosixSemaphoreWaiter() { close(); }
+
+        bool create(DoorbellState&, const juce::String& name)
+        {
+            close();
+            semaphoreName = getSystemName(name);
+            sem_unlink(semaphoreName.toRawUTF8());
+            semaphore = sem_open(semaphoreName.toRawUTF8(), O_CREAT | O_EXCL, 0600, 0);
+            ownsName = true;
+            return semaphore != SEM_FAILED;
+        }
+
+        bool open(DoorbellState&, const juce::String& name)
+        {
+            close();
+            semaphore = sem_open(getSystemName(name).toRawUTF8(), 0);
+            return semaphore != SEM_FAILED;
+        }
+
+        void close()
+        {
+            if (semaphore != SEM_FAILED)
+                sem_close(semaphore);
+
+            if (ownsName)
+                sem_unlink(semaphoreName.toRawUTF8());
+
+            semaphore = SEM_FAILED;
+            ownsName = false;
+        }
+
+        void wait(DoorbellState&, uint32_t, int timeoutMs)
+        {
+            // sem_timedwait is missing on macOS, so poll in short slices
+            const auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32)juce::jmax(0, timeoutMs);
+
+            while (sem_trywait(semaphore) != 0)
+            {
+                if (timeoutMs >= 0 && juce::Time::getMillisecondCounter() >= deadline)
+                    return;
+
+                juce::Thread::sleep(1);
+            }
+        }
+
+        void wake(DoorbellState&)
+        {
+            sem_post(semaphore);
+        }
+
+    private:
+        static juce::String getSystemName(const juce::String& name)
+        {
+            return "/vb1_" + juce::String::toHexString(name.hashCode64());
+        }
+
+        sem_t* semaphore = SEM_FAILED;
+        juce::String semaphoreName;
+        bool ownsName = false;
+    };
+
+    using DoorbellWaiter = PosixSemaphoreWaiter;
+   #endif
+
+    //==============================================================================
+    // One-way "something happened" signal between the two processes.
+    // ring() bumps a sequence counter; wait() spins on it for a bounded number
+    // of iterations before falling back to the kernel, which is only woken when
+    // the other side has actually gone to sleep.
+    class Doorbell
+    {
+    public:
+        Doorbell() = default;
+        ~Doorbell() { close(); }
+
+        bool create(DoorbellState& sharedState, const juce::String& name)
+        {
+            sharedState.sequence.store(0);
+            sharedState.waiters.store(0);
+            state = &sharedState;
+
+            if (!waiter.create(sharedState, name))
+                state = nullptr;
+
+            return state != nullptr;
+        }
+
+        bool open(DoorbellState& sharedState, const juce::String& name)
+        {
+            state = &sharedState;
+
+            if (!waiter.open(sharedState, name))
+                state = nullptr;
+
+            return state != nullptr;
+        }
+
+        void close()
+        {
+            waiter.close();
+            state = nullptr;
+        }
+
+        bool isOpen() const noexcept { return state != nullptr; }
+
+        void setSpinIterations(int iterations) noexcept { spinIterations = juce::jmax(0, iterations); }
+
+        uint32_t current() const noexcept { return state->sequence.load(std::memory_order_acquire); }
+
+        void ring()
+        {
+            state->sequence.fetch_add(1, std::memory_order_seq_cst);
+
+            if (state->waiters.load(std::memory_order_seq_cst) > 0)
+                waiter.wake(*state);
+        }
+
+        // Returns true once the sequence has moved on from lastSeen, false on timeout
+        bool wait(uint32_t lastSeen, int timeoutMs)
+        {
+            for (int i = 0; i < spinIterations; ++i)
+            {
+                if (current() != lastSeen)
+                    return true;
+
+                cpuRelax();
+            }
+
+            const auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32)juce::jmax(0, timeoutMs);
+            bool signalled = false;
+
+            state->waiters.fetch_add(1, std::memory_order_seq_cst);
+
+            for (;;)
+            {
+                if (state->sequence.load(std::memory_order_seq_cst) != lastSeen)
+                {
+                    signalled = true;
+                    break;
+                }
+
+                const auto now = juce::Time::getMillisecondCounter();
+
+                if (now >= deadline)
+                    break;
+
+                waiter.wait(*state, lastSeen, (int)(deadline - now));
+            }
+
+            state->waiters.fetch_sub(1, std::memory_order_seq_cst);
+            return signalled;
+        }
+
+    private:
+        DoorbellState* state = nullptr;
+        DoorbellWaiter waiter;
+        int spinIterations = kDefaultDoorbellSpinIterations;
+
+        JUCE_DECLARE_NON_COPYABLE(Doorbell)
+    };
+
+} // namespace VST1Bridge
@@ -0,0 +1,510 @@
+// ==============================================================================
+// FILE: BridgeProcess.cpp
+// ==============================================================================
+#include "BridgeProcess.h"
+
+BridgeProcess::BridgeProcess(const juce::String& arch, const juce::String& group)
+    : juce::Thread("VST1Bridge responses"), architecture(arch), isolationGroup(group)
+{
+}
+
+BridgeProcess::~BridgeProcess()
+{
+    stop();
+}
+
+juce::File BridgeProcess::getExecutableFor(const juce::String& arch)
+{
+    // Bridge executables live next to the VST3
+    return juce::File::getSpecialLocation(juce::File::currentExecutableFile)
+        .getParentDirectory()
+        .getChildFile(arch == "x64" ? "VST1Bridge64.exe" : "VST1Bridge32.exe");
+}
+
+juce::String BridgeProcess::getArchitectureOf(const juce::File& dllFile)
+{
+    juce::FileInputStream stream(dllFile);
+
+    if (!stream.openedOk())
+        return "x86";
+
+    // IMAGE_DOS_HEADER::e_lfanew, then "PE\0\0" and IMAGE_FILE_HEADER::Machine
+    stream.setPosition(0x3c);
+    const auto peOffset = stream.readInt();
+
+    if (peOffset <= 0 || !stream.setPosition(peOffset) || stream.readInt() != 0x00004550)
+        return "x86";
+
+    const auto machine = (uint16_t)stream.readShort();
+    return machine == 0x8664 ? "x64" : "x86";
+}
+
+bool BridgeProcess::start()
+{
+    juce::File exeFile = getExecutableFor(architecture);
+
+    if (!exeFile.existsAsFile())
+    {
+        DBG("Bridge executable not found at: " + exeFile.getFullPathName());
+        return false;
+    }
+
+    // Several instances can start in the same millisecond, a UUID cannot collide
+    pipeName = "VST1Bridge_" + juce::Uuid().toString();
+
+    // Create named pipes
+    pipeToChild = std::make_unique<juce::NamedPipe>();
+    pipeFromChild = std::make_unique<juce::NamedPipe>();
+
+    if (!pipeToChild->createNewPipe(pipeName + "_to", true) ||
+        !pipeFromChild->createNewPipe(pipeName + "_from", true))
+    {
+        DBG("Failed to create named pipes");
+        return false;
+    }
+
+    // Launch bridge process with pipe names as arguments
+    juce::String commandLine = exeFile.getFullPathName().quoted() + " " +
+        (pipeName + "_to").quoted() + " " +
+        (pipeName + "_from").quoted();
+
+    if (!process.start(commandLine))
+    {
+        DBG("Failed to start bridge process");
+        return false;
+    }
+
+    if (!waitForHello(5000))
+    {
+        stop();
+        return false;
+    }
+
+    startThread(juce::Thread::Priority::high);
+
+    DBG("Bridge process connected successfully");
+    return true;
+}
+
+bool BridgeProcess::readFromChild(void* dest, int numBytes, uint32_t deadlineMs)
+{
+    auto* bytes = static_cast<char*>(dest);
+    int numRead = 0;
+
+    // Each read gets all the time that is left: one that times out drops whatever it had
+    // of a partial message. The read returns as soon as the data has arrived.
+    while (numRead < numBytes)
+    {
+        if (threadShouldExit() || !process.isRunning() || !pipeFromChild->isOpen())
+            return false;
+
+        int timeoutMs = -1;
+
+        if (deadlineMs != std::numeric_limits<uint32_t>::max())
+        {
+            const auto now = juce::Time::getMillisecondCounter();
+
+            if (now >= deadlineMs)
+                return false;
+
+            timeoutMs = (int)(deadlineMs - now);
+        }
+
+        const auto result = pipeFromChild->read(bytes + numRead, numBytes - numRead, timeoutMs);
+
+        // Without a deadline only a broken pipe ends the read early
+        if (result < 0 && timeoutMs < 0)
+            return false;
+
+        // Timed out, or the pipe broke: the checks above tell which
+        if (result > 0)
+            numRead += result;
+    }
+
+    return true;
+}
+
+bool BridgeProcess::waitForHello(int timeoutMs)
+{
+    const auto deadline = juce::Time::getMillisecondCounter() + (uint32_t)timeoutMs;
+
+    VST1Bridge::MessageHeader header;
+    VST1Bridge::HelloMessage hello;
+
+    if (!readFromChild(&header, sizeof(header), deadline)
+        || header.type != VST1Bridge::MessageType::Hello
+        || header.dataSize != sizeof(hello)
+        || !readFromChild(&hello, sizeof(hello), deadline))
+    {
+        DBG("Bridge process did not say hello");
+        return false;
+    }
+
+    if (hello.protocolVersion != VST1Bridge::kProtocolVersion)
+    {
+        DBG("Bridge protocol version " + juce::String(hello.protocolVersion)
+            + " does not match " + juce::String(VST1Bridge::kProtocolVersion));
+        return false;
+    }
+
+    capabilities = hello.capabilities;
+    return true;
+}
+
+void BridgeProcess::stop()
+{
+    signalThreadShouldExit();
+
+    {
+        const juce::ScopedLock sl(writeLock);
+
+        if (process.isRunning())
+        {
+            VST1Bridge::MessageHeader header;
+            header.type = VST1Bridge::MessageType::Shutdown;
+            header.dataSize = 0;
+            header.sequenceId = messageSequence++;
+            header.instanceId = 0;
+
+            if (pipeToChild && pipeToChild->isOpen())
+                pipeToChild->write(&header, sizeof(header), 1000);
+
+            juce::Thread::sleep(100);
+            process.kill();
+        }
+    }
+
+    // Closing the pipe cancels the reader's blocking read
+    if (pipeFromChild != nullptr)
+        pipeFromChild->close();
+
+    stopThread(1000);
+    failPendingRequests();
+
+    const juce::ScopedLock sl(writeLock);
+    pipeToChild.reset();
+    pipeFromChild.reset();
+}
+
+bool BridgeProcess::isRunning() const
+{
+    return pipeToChild != nullptr && process.isRunning();
+}
+
+bool BridgeProcess::transact(uint32_t instanceId, VST1Bridge::MessageType type,
+    const void* data, uint32_t dataSize, VST1Bridge::ResponseMessage& response, int timeoutMs)
+{
+    PendingRequest pending;
+
+    VST1Bridge::MessageHeader header;
+    header.type = type;
+    header.dataSize = data != nullptr ? dataSize : 0;
+    header.instanceId = instanceId;
+
+    {
+        const juce::ScopedLock sl(writeLock);
+
+        if (!pipeToChild || !pipeToChild->isOpen() || !pipeFromChild || !pipeFromChild->isOpen())
+            return false;
+
+        header.sequenceId = messageSequence++;
+        pending.sequenceId = header.sequenceId;
+
+        {
+            const juce::ScopedLock pl(pendingLock);
+
+            if (connectionLost)
+                return false;
+
+            pendingRequests.add(&pending);
+        }
+
+        const bool sent = pipeToChild->write(&header, sizeof(header), 1000) == sizeof(header)
+            && (header.dataSize == 0
+                || pipeToChild->write(data, (int)header.dataSize, 1000) == (int)header.dataSize);
+
+        if (!sent)
+        {
+            const juce::ScopedLock pl(pendingLock);
+            pendingRequests.removeFirstMatchingValue(&pending);
+            return false;
+        }
+    }
+
+    pending.done.wait(timeoutMs);
+
+    // A response that arrives after this point is dropped by the reader
+    const juce::ScopedLock pl(pendingLock);
+    pendingRequests.removeFirstMatchingValue(&pending);
+
+    if (!pending.received)
+        return false;
+
+    response = pending.response;
+    return true;
+}
+
+void BridgeProcess::run()
+{
+    juce::HeapBlock<char> discard;
+
+    while (!threadShouldExit())
+    {
+        VST1Bridge::MessageHeader header;
+
+        if (!readFromChild(&header, sizeof(header), std::numeric_limits<uint32_t>::max()))
+            break;
+
+        if (header.type != VST1Bridge::MessageType::Response
+            || header.dataSize != sizeof(VST1Bridge::ResponseMessage))
+        {
+            // Nothing else is sent unprompted yet, skip whatever it is
+            discard.malloc(juce::jmax((uint32_t)1, header.dataSize));
+
+            if (header.dataSize > 0 && !readFromChild(discard, (int)header.dataSize, std::numeric_limits<uint32_t>::max()))
+                break;
+
+            continue;
+        }
+
+        VST1Bridge::ResponseMessage response;
+
+        if (!readFromChild(&response, sizeof(response), std::numeric_limits<uint32_t>::max()))
+            break;
+
+        const juce::ScopedLock pl(pendingLock);
+
+        for (auto* pending : pendingRequests)
+        {
+            if (pending->sequenceId == header.sequenceId)
+            {
+                pending->response = response;
+                pending->received = true;
+                pending->done.signal();
+                break;
+            }
+        }
+    }
+
+    failPendingRequests();
+}
+
+void BridgeProcess::failPendingRequests()
+{
+    const juce::ScopedLock pl(pendingLock);
+    connectionLost = true;
+
+    for (auto* pending : pendingRequests)
+        pending->done.signal();
+}
+
+//==============================================================================
+JUCE_IMPLEMENT_SINGLETON(BridgeProcessRegistry)
+
+namespace
+{
+    // Back-off after a spare failed to start, e.g. when the bridge executable is missing
+    constexpr int refillRetryMs = 10000;
+    // Idle wake-up to replace spares that died while waiting
+    constexpr int spareCheckIntervalMs = 5000;
+    // How long spares are kept for an architecture nothing uses any more
+    constexpr juce::uint32 spareIdleTimeoutMs = 60000;
+}
+
+BridgeProcessRegistry::BridgeProcessRegistry()
+    : juce::Thread("VST1Bridge process pool")
+{
+    startThread(juce::Thread::Priority::background);
+}
+
+BridgeProcessRegistry::~BridgeProcessRegistry()
+{
+    signalThreadShouldExit();
+    notify();
+    stopThread(10000);
+
+    for (auto* spare : spares)
+        spare->stop();
+
+    clearSingletonInstance();
+}
+
+BridgeProcess::Ptr BridgeProcessRegistry::acquire(const juce::String& architecture, const juce::String& isolationGroup)
+{
+    // Instances restored in parallel must all end up in the same shared process,
+    // so only one of them may launch it. Isolated groups are unique anyway.
+    if (isolationGroup.isEmpty())
+    {
+        const juce::ScopedLock startSl(sharedStartLock);
+        return findOrStart(architecture, isolationGroup);
+    }
+
+    return findOrStart(architecture, isolationGroup);
+}
+
+BridgeProcess::Ptr BridgeProcessRegistry::findOrStart(const juce::String& architecture, const juce::String& isolationGroup)
+{
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto* process : processes)
+            if (process->getArchitecture() == architecture
+                && process->getIsolationGroup() == isolationGroup
+                && process->isRunning())
+                return process;
+
+        warmArchitectures.addIfNotAlreadyThere(architecture);
+    }
+
+    BridgeProcess::Ptr process = claimSpare(architecture);
+    notify();
+
+    // Pool empty or disabled: pay for the launch here
+    if (process == nullptr)
+    {
+        process = new BridgeProcess(architecture, isolationGroup);
+
+        if (!process->start())
+            return nullptr;
+    }
+
+    process->setIsolationGroup(isolationGroup);
+
+    const juce::ScopedLock sl(lock);
+    processes.add(process);
+    return process;
+}
+
+BridgeProcess::Ptr BridgeProcessRegistry::claimSpare(const juce::String& architecture)
+{
+    const juce::ScopedLock sl(lock);
+
+    for (int i = 0; i < spares.size(); ++i)
+    {
+        BridgeProcess::Ptr spare = spares[i];
+
+        if (spare->getArchitecture() == architecture && spare->isRunning())
+        {
+            spares.remove(i);
+            return spare;
+        }
+    }
+
+    return nullptr;
+}
+
+void BridgeProcessRegistry::release(BridgeProcess::Ptr& process)
+{
+    if (process == nullptr)
+        return;
+
+    BridgeProcess::Ptr unused;
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        // One reference held by the registry, one by the caller
+        if (process->getReferenceCount() <= 2)
+        {
+            processes.removeObject(process.get());
+            unused = process;
+        }
+
+        process = nullptr;
+    }
+
+    // Stopping waits for the process to exit, acquire() and release() elsewhere must not wait for that
+    if (unused != nullptr)
+        unused->stop();
+}
+
+void BridgeProcessRegistry::setWarmPoolSize(int numSpares)
+{
+    {
+        const juce::ScopedLock sl(lock);
+        warmPoolSize = juce::jmax(0, numSpares);
+    }
+
+    notify();
+}
+
+// Dead spares, and those of architectures that have been idle too long, go into unwanted
+juce::String BridgeProcessRegistry::findArchitectureToRefill(juce::ReferenceCountedArray<BridgeProcess>& unwanted)
+{
+    const juce::ScopedLock sl(lock);
+    const auto now = juce::Time::getMillisecondCounter();
+
+    for (int i = spares.size(); --i >= 0;)
+        if (!spares[i]->isRunning())
+            unwanted.add(spares.removeAndReturn(i));
+
+    for (int i = warmArchitectures.size(); --i >= 0;)
+    {
+        const auto architecture = warmArchitectures[i];
+        const bool inUse = std::any_of(processes.begin(), processes.end(),
+            [&architecture](BridgeProcess* process) { return process->getArchitecture() == architecture; });
+
+        if (inUse)
+        {
+            idleSinceMs.erase(architecture);
+            continue;
+        }
+
+        const auto idleSince = idleSinceMs.try_emplace(architecture, now).first->second;
+
+        if (now - idleSince < spareIdleTimeoutMs)
+            continue;
+
+        for (int j = spares.size(); --j >= 0;)
+            if (spares[j]->getArchitecture() == architecture)
+                unwanted.add(spares.removeAndReturn(j));
+
+        warmArchitectures.remove(i);
+        idleSinceMs.erase(architecture);
+    }
+
+    for (auto& architecture : warmArchitectures)
+    {
+        int numWarm = 0;
+
+        for (auto* spare : spares)
+            if (spare->getArchitecture() == architecture)
+                ++numWarm;
+
+        if (numWarm < warmPoolSize)
+            return architecture;
+    }
+
+    return {};
+}
+
+void BridgeProcessRegistry::run()
+{
+    while (!threadShouldExit())
+    {
+        juce::ReferenceCountedArray<BridgeProcess> unwanted;
+        const auto architecture = findArchitectureToRefill(unwanted);
+
+        // Not under the lock, stopping waits for the process to exit
+        for (auto* spare : unwanted)
+            spare->stop();
+
+        if (architecture.isEmpty())
+        {
+            wait(spareCheckIntervalMs);
+            continue;
+        }
+
+        // Launch outside the lock, acquire() must not wait for it
+        BridgeProcess::Ptr spare = new BridgeProcess(architecture, {});
+
+        if (!spare->start())
+        {
+            wait(refillRetryMs);
+            continue;
+        }
+
+        const juce::ScopedLock sl(lock);
+        spares.add(spare);
+    }
+}
@@ -0,0 +1,162 @@
+// ==============================================================================
+// FILE: BridgeProcess.h
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include <map>
+#include "BridgeProtocol.h"
+
+// One running bridge executable and its pipe pair. Every VST1BridgeProcessor in
+// the same (architecture, isolation group) shares a BridgeProcess and addresses
+// its own plugin inside it through the instanceId in MessageHeader.
+class BridgeProcess : public juce::ReferenceCountedObject,
+                      private juce::Thread
+{
+public:
+    using Ptr = juce::ReferenceCountedObjectPtr<BridgeProcess>;
+
+    BridgeProcess(const juce::String& architecture, const juce::String& isolationGroup);
+    ~BridgeProcess() override;
+
+    bool start();
+    void stop();
+    bool isRunning() const;
+
+    // Sends one request and waits for its response. Any number of threads may be
+    // waiting at once: a reader thread hands each response to its request by
+    // sequenceId, and the bridge works on different instances in parallel.
+    bool transact(uint32_t instanceId, VST1Bridge::MessageType type,
+        const void* data, uint32_t dataSize, VST1Bridge::ResponseMessage& response,
+        int timeoutMs = 2000);
+
+    uint32_t allocateInstanceId() { return nextInstanceId++; }
+
+    const juce::String& getArchitecture() const { return architecture; }
+    const juce::String& getIsolationGroup() const { return isolationGroup; }
+
+    // Pooled processes are started before anyone knows which group will claim them
+    void setIsolationGroup(const juce::String& group) { isolationGroup = group; }
+
+    // Unique per process, used to derive shared memory and doorbell names
+    const juce::String& getName() const { return pipeName; }
+
+    // kCapability* bits from the bridge's Hello
+    uint32_t getCapabilities() const { return capabilities; }
+
+    // "x86" or "x64", read from the PE header of a plugin DLL
+    static juce::String getArchitectureOf(const juce::File& dllFile);
+    static juce::File getExecutableFor(const juce::String& architecture);
+
+private:
+    struct PendingRequest
+    {
+        uint32_t sequenceId = 0;
+        bool received = false;
+        VST1Bridge::ResponseMessage response;
+        juce::WaitableEvent done;
+    };
+
+    void run() override;
+    void failPendingRequests();
+    bool waitForHello(int timeoutMs);
+    // Reads exactly numBytes. A deadline of numeric_limits<uint32_t>::max() blocks until
+    // the data arrives, the child dies or stop() closes the pipe.
+    bool readFromChild(void* dest, int numBytes, uint32_t deadlineMs);
+
+    const juce::String architecture;
+    juce::String isolationGroup;
+
+    juce::ChildProcess process;
+    std::unique_ptr<juce::NamedPipe> pipeToChild;
+    std::unique_ptr<juce::NamedPipe> pipeFromChild;
+    juce::String pipeName;
+    uint32_t capabilities = 0;
+
+    juce::CriticalSection writeLock;
+    uint32_t messageSequence = 0;
+
+    juce::CriticalSection pendingLock;
+    juce::Array<PendingRequest*> pendingRequests;
+    bool connectionLost = false;
+    std::atomic<uint32_t> nextInstanceId { 1 };
+
+    JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(BridgeProcess)
+};
+
+// Builds the payload of a MessageType::Batch request
+class CommandBatch
+{
+public:
+    template <typename MessageStruct>
+    void add(VST1Bridge::MessageType type, const MessageStruct& message)
+    {
+        add(type, &message, sizeof(message));
+    }
+
+    void add(VST1Bridge::MessageType type, const void* payload = nullptr, uint32_t payloadSize = 0)
+    {
+        jassert(numCommands < VST1Bridge::kMaxBatchCommands);
+        jassert(type != VST1Bridge::MessageType::Batch);
+
+        VST1Bridge::BatchCommandHeader header;
+        header.type = type;
+        header.dataSize = payload != nullptr ? payloadSize : 0;
+
+        data.append(&header, sizeof(header));
+
+        if (header.dataSize > 0)
+            data.append(payload, header.dataSize);
+
+        ++numCommands;
+    }
+
+    int size() const noexcept { return numCommands; }
+    const void* getData() const noexcept { return data.getData(); }
+    uint32_t getDataSize() const noexcept { return (uint32_t)data.getSize(); }
+
+    // True if command i succeeded, given the batch response's intValue
+    static bool succeeded(int32_t statusBits, int commandIndex) noexcept
+    {
+        return (((uint32_t)statusBits >> commandIndex) & 1u) != 0;
+    }
+
+private:
+    juce::MemoryBlock data;
+    int numCommands = 0;
+};
+
+// Process-wide table of running bridge processes, keyed by architecture and isolation group.
+// A background thread keeps a few started and connected spares per architecture, so a new
+// process can be claimed without waiting for the executable to launch. Once no process of
+// an architecture has been in use for a while, its spares are stopped and not replaced.
+class BridgeProcessRegistry : private juce::DeletedAtShutdown,
+                              private juce::Thread
+{
+public:
+    BridgeProcessRegistry();
+    ~BridgeProcessRegistry() override;
+
+    // Returns the running process for this key, claiming a spare or starting one if needed
+    BridgeProcess::Ptr acquire(const juce::String& architecture, const juce::String& isolationGroup);
+
+    // Drops the caller's reference and stops the process once nobody else uses it
+    void release(BridgeProcess::Ptr& process);
+
+    // Number of idle processes kept warm per architecture (0 disables the pool)
+    void setWarmPoolSize(int numSpares);
+
+    JUCE_DECLARE_SINGLETON(BridgeProcessRegistry, false)
+
+private:
+    void run() override;
+    BridgeProcess::Ptr findOrStart(const juce::String& architecture, const juce::String& isolationGroup);
+    BridgeProcess::Ptr claimSpare(const juce::String& architecture);
+    juce::String findArchitectureToRefill(juce::ReferenceCountedArray<BridgeProcess>& unwanted);
+
+    juce::CriticalSection lock, sharedStartLock;
+    juce::ReferenceCountedArray<BridgeProcess> processes;
+    juce::ReferenceCountedArray<BridgeProcess> spares;
+    juce::StringArray warmArchitectures { "x86" };
+    std::map<juce::String, juce::uint32> idleSinceMs;  // warm architectures with no process in use
+    int warmPoolSize = 2;
+};
@@ -2,6 +2,8 @@
 // FILE: BridgeProtocol.h (Shared between 64-bit and 32-bit processes)
 // ==============================================================================
 #pragma once
+#include <atomic>
+#include <cstddef>
 #include <cstdint>
 
 namespace VST1Bridge {
@@ -11,24 +13,57 @@ namespace VST1Bridge {
         UnloadPlugin,
         SetSampleRate,
         SetBlockSize,
-        ProcessAudio,
-        ProcessMidi,
+        ProcessAudio,   // unused, blocks go through the shared audio region
+        ProcessMidi,    // unused, MIDI travels with the block it belongs to
         SetParameter,
         GetParameter,
         Suspend,
         Resume,
         Shutdown,
+        AttachAudioBuffer,
+        DestroyInstance,
+        Hello,          // sent unprompted by the bridge as soon as it has connected
+        GetParameterCount,
+        GetParameterInfo,   // every parameter at once, see ParameterInfoEntry
+        Batch,          // several commands for one instance in one round trip
+        SetIOConfiguration,
+        GetState,
+        SetState,
+        LoadPreset,
+        SavePreset,
         Response
     };
 
+    // Bumped whenever a message layout changes; the host refuses bridges built against another version
+    constexpr uint32_t kProtocolVersion = 18;
+
+    // Capability bits advertised in HelloMessage
+    constexpr uint32_t kCapabilitySharedAudio   = 1u << 0;
+    constexpr uint32_t kCapabilityPlanarAudio   = 1u << 1;
+    constexpr uint32_t kCapabilityMultiInstance = 1u << 2;
+
+    struct HelloMessage {
+        uint32_t protocolVersion;
+        uint32_t capabilities;
+        uint32_t pointerSize;   // 4 for the 32-bit bridge, 8 for the 64-bit one
+    };
+
     struct MessageHeader {
         MessageType type;
         uint32_t dataSize;
-        uint32_t sequenceId;
+        uint32_t sequenceId;    // echoed back in the matching Response
+        uint32_t instanceId;    // which hosted plugin in the bridge process this is for
+    };
+
+    // How samples are laid out in the shared audio region
+    enum class AudioLayout : int32_t {
+        Interleaved,    // frame by frame, channel stride 1
+        Planar          // one contiguous run of maxSamples per channel
     };
 
     struct LoadPluginMessage {
         char dllPath[512];
+        AudioLayout preferredLayout;    // the response's intValue carries the layout the bridge accepted
     };
 
     struct SetSampleRateMessage {
@@ -39,11 +74,276 @@ namespace VST1Bridge {
         int32_t blockSize;
     };
 
+    struct IOConfigurationMessage {
+        int32_t numInputs;
+        int32_t numOutputs;
+        int32_t nonRealtime;    // the host is rendering offline
+    };
+
     struct ProcessAudioMessage {
         int32_t numSamples;
         int32_t numInputs;
         int32_t numOutputs;
-        // Followed by float audio data
+        AudioLayout layout;
+        int32_t numMidiEvents;  // entries used in SharedAudioHeader::midiEvents
+        uint32_t parameterQueueEnd; // SharedParameterQueue::writePosition after this block's changes
+        // Audio data lives in the shared audio region (see AttachAudioBufferMessage)
+    };
+
+    // Short MIDI message for one block. SysEx is not forwarded.
+    struct SharedMidiEvent {
+        int32_t deltaFrames;    // sample offset inside the block
+        uint8_t data[4];        // status and up to two data bytes
+    };
+
+    constexpr int32_t kMaxMidiEventsPerBlock = 1024;
+
+    // Transport state for one block, captured from the host's AudioPlayHead. The bridge
+    // answers audioMasterGetTime from its copy, so plugins never wait on the host for it.
+    constexpr uint32_t kTimeInfoPlaying         = 1u << 0;
+    constexpr uint32_t kTimeInfoRecording       = 1u << 1;
+    constexpr uint32_t kTimeInfoLooping         = 1u << 2;
+    constexpr uint32_t kTimeInfoPpqValid        = 1u << 3;
+    constexpr uint32_t kTimeInfoTempoValid      = 1u << 4;
+    constexpr uint32_t kTimeInfoBarValid        = 1u << 5;
+    constexpr uint32_t kTimeInfoLoopValid       = 1u << 6;
+    constexpr uint32_t kTimeInfoTimeSigValid    = 1u << 7;
+    constexpr uint32_t kTimeInfoSystemTimeValid = 1u << 8;
+
+    struct SharedTimeInfo {
+        uint32_t flags;             // kTimeInfo* bits
+        int32_t timeSigNumerator;
+        int32_t timeSigDenominator;
+        int32_t reserved;
+        double samplePosition;      // always valid, 0 without a play head
+        double sampleRate;
+        double ppqPosition;
+        double tempo;
+        double barStartPpq;
+        double loopStartPpq;
+        double loopEndPpq;
+        double systemTimeNanos;
+    };
+
+    // Parameter slots the host side exposes; plugins with more have the rest unmapped.
+    // Enough for the big synths, and the mirror is still only a few KB.
+    constexpr int32_t kMaxBridgedParameters = 1024;
+
+    // Current plugin parameter values, published by the bridge. The host reads them
+    // without IPC and only forwards indices whose dirty bit is set to its listeners.
+    struct SharedParameterMirror {
+        std::atomic<uint32_t> sequence;     // bumped after every dirty publish
+        std::atomic<uint32_t> dirtyBits[kMaxBridgedParameters / 32];
+        std::atomic<float> values[kMaxBridgedParameters];
+
+        void reset() noexcept
+        {
+            sequence.store(0, std::memory_order_relaxed);
+
+            for (auto& bits : dirtyBits)
+                bits.store(0, std::memory_order_relaxed);
+
+            for (auto& value : values)
+                value.store(0.0f, std::memory_order_relaxed);
+        }
+
+        // A change made by the plugin itself: the host passes it on. False if nothing changed.
+        bool publish(int32_t index, float value) noexcept
+        {
+            if (index < 0 || index >= kMaxBridgedParameters
+                || values[index].exchange(value, std::memory_order_relaxed) == value)
+                return false;
+
+            dirtyBits[index / 32].fetch_or(1u << (index % 32), std::memory_order_release);
+            sequence.fetch_add(1, std::memory_order_release);
+            return true;
+        }
+
+        // A change that came from the host: recorded, but not echoed back
+        void store(int32_t index, float value) noexcept
+        {
+            if (index >= 0 && index < kMaxBridgedParameters)
+                values[index].store(value, std::memory_order_relaxed);
+        }
+
+        template <typename Callback>
+        void collectDirty(Callback&& callback) noexcept
+        {
+            for (int32_t word = 0; word < kMaxBridgedParameters / 32; ++word)
+            {
+                auto bits = dirtyBits[word].exchange(0, std::memory_order_acquire);
+
+                for (int32_t bit = 0; bits != 0; ++bit, bits >>= 1)
+                    if ((bits & 1) != 0)
+                        callback(word * 32 + bit, values[word * 32 + bit].load(std::memory_order_relaxed));
+            }
+        }
+    };
+
+    static_assert(std::atomic<float>::is_always_lock_free, "The parameter mirror needs address-free atomics");
+
+    struct SharedParameterChange {
+        int32_t index;
+        float value;
+    };
+
+    // Lock-free ring in shared memory. The host audio thread is the only producer,
+    // the bridge audio thread the only consumer; changes are drained before each block,
+    // up to where the queue stood when that block was submitted. With two pipeline slots
+    // the next block's changes may already be queued, and must wait for it.
+    struct SharedParameterQueue {
+        static constexpr uint32_t capacity = 512; // power of two
+
+        std::atomic<uint32_t> writePosition;
+        std::atomic<uint32_t> readPosition;
+        SharedParameterChange changes[capacity];
+
+        void reset() noexcept
+        {
+            writePosition.store(0, std::memory_order_relaxed);
+            readPosition.store(0, std::memory_order_relaxed);
+        }
+
+        bool push(const SharedParameterChange& change) noexcept
+        {
+            const auto write = writePosition.load(std::memory_order_relaxed);
+
+            if (write - readPosition.load(std::memory_order_acquire) >= capacity)
+                return false;
+
+            changes[write & (capacity - 1)] = change;
+            writePosition.store(write + 1, std::memory_order_release);
+            return true;
+        }
+
+        template <typename Callback>
+        void drain(uint32_t end, Callback&& callback) noexcept
+        {
+            auto read = readPosition.load(std::memory_order_relaxed);
+            const auto write = writePosition.load(std::memory_order_acquire);
+
+            // Past what was written: a bound from before a reset
+            if (end - read > write - read)
+                end = write;
+
+            for (; read != end; ++read)
+                callback(changes[read & (capacity - 1)]);
+
+            readPosition.store(read, std::memory_order_release);
+        }
+    };
+
+    // Block handoff signal living in shared memory (see BridgeDoorbell.h)
+    struct DoorbellState {
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> waiters;
+    };
+
+    static_assert(std::atomic<uint32_t>::is_always_lock_free, "Doorbells need address-free atomics");
+
+    // Shared audio region: the host writes input samples in place, the bridge
+    // writes output samples in place, both in the negotiated layout. Block n goes
+    // through slot n % numSlots: the host fills the slot and rings blockReady, the
+    // bridge sets blockSucceeded and rings blockDone. With two slots the host can
+    // submit the next block while the bridge is still working on the previous one.
+    constexpr uint32_t kSharedAudioMagic = 0x56423141; // 'VB1A'
+    constexpr int32_t kDefaultSharedAudioSamples = 4096;
+    constexpr int32_t kDefaultDoorbellSpinIterations = 2000;
+    constexpr int32_t kMaxPipelineSlots = 2;
+
+    struct SharedBlockSlot {
+        ProcessAudioMessage block;
+        int32_t blockSucceeded;
+        SharedTimeInfo timeInfo;
+        SharedMidiEvent midiEvents[kMaxMidiEventsPerBlock];
+    };
+
+    struct alignas(64) SharedAudioHeader {
+        uint32_t magic;
+        uint32_t maxChannels;
+        uint32_t maxSamples;
+        uint32_t numSlots;
+        uint32_t sampleSize;    // sizeof(float), or sizeof(double) for a double-precision host
+        DoorbellState blockReady;
+        DoorbellState blockDone;
+        SharedBlockSlot slots[kMaxPipelineSlots];
+        SharedParameterQueue parameterQueue;
+        SharedParameterMirror parameterMirror;
+        // Published by the bridge after loading, resuming and on audioMasterIOChanged
+        std::atomic<int32_t> pluginLatencySamples;  // AEffect::initialDelay
+        std::atomic<int32_t> pluginTailSamples;     // effGetTailSize, 0 for none or unknown
+        // Bumped by the bridge whenever the plugin's state may have changed. While it stands
+        // still, the host's last GetState result is still current.
+        std::atomic<uint32_t> stateGeneration;
+        // Followed by numSlots * maxChannels * maxSamples input samples,
+        // then numSlots * maxChannels * maxSamples output samples
+    };
+
+    inline size_t getSharedAudioSize(int32_t maxChannels, int32_t maxSamples, int32_t numSlots = 1,
+        int32_t sampleSize = (int32_t)sizeof(float))
+    {
+        return sizeof(SharedAudioHeader)
+            + 2 * (size_t)numSlots * (size_t)maxChannels * (size_t)maxSamples * (size_t)sampleSize;
+    }
+
+    // A Batch payload is a sequence of BatchCommandHeader, each followed by its own
+    // dataSize bytes of payload. The commands run in order; the response's intValue
+    // has bit i set if command i succeeded, and success is set if all of them did.
+    struct BatchCommandHeader {
+        MessageType type;
+        uint32_t dataSize;
+    };
+
+    constexpr int32_t kMaxBatchCommands = 32;
+
+    struct AttachAudioBufferMessage {
+        char regionName[128];
+        int32_t maxChannels;
+        int32_t maxSamples;
+        int32_t spinIterations;
+        int32_t numSlots;       // 1, or 2 for pipelined processing
+        int32_t sampleSize;     // see SharedAudioHeader::sampleSize
+    };
+
+    // Plugin state never goes through the pipe: the host creates a one-off shared region
+    // and names it here. For GetState, size is the region's capacity; the bridge copies the
+    // state in if it fits and answers its size in intValue either way, so the host can
+    // retry with a bigger region. For SetState, size is the number of bytes to apply.
+    // If the state hashes to knownHash, GetState copies nothing and answers a size of 0.
+    // LoadPreset and SavePreset move the bytes of an .fxp or .fxb file the same way, and
+    // GetParameterInfo a ParameterInfoEntry per parameter.
+    struct StateTransferMessage {
+        char regionName[128];
+        int32_t size;
+        int32_t asBank;         // SavePreset: an .fxb of every program instead of an .fxp
+        uint64_t knownHash;     // hashPluginState of the host's cached state, 0 for none
+    };
+
+    // 64-bit FNV-1a, computed the same way on both sides of the pipe
+    inline uint64_t hashPluginState(const void* data, size_t size) noexcept
+    {
+        auto hash = (uint64_t)0xcbf29ce484222325ull;
+
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ static_cast<const uint8_t*>(data)[i]) * 0x100000001b3ull;
+
+        return hash;
+    }
+
+    // Captured plugin state: this header, then the effGetChunk bytes or one float per parameter
+    constexpr uint32_t kPluginStateMagic = 0x56423153; // 'VB1S'
+
+    enum class PluginStateFormat : uint32_t {
+        Chunk,
+        Parameters
+    };
+
+    struct PluginStateHeader {
+        uint32_t magic;
+        PluginStateFormat format;
+        int32_t uniqueID;       // state is only applied to the plugin that produced it
+        int32_t currentProgram;
+        int32_t dataSize;       // bytes following this header
     };
 
     struct SetParameterMessage {
@@ -55,6 +355,13 @@ namespace VST1Bridge {
         int32_t index;
     };
 
+    // One per plugin parameter, up to kMaxBridgedParameters, in parameter order
+    struct ParameterInfoEntry {
+        float value;
+        char name[64];
+        char label[16];     // unit, from effGetParamLabel
+    };
+
     struct ResponseMessage {
         bool success;
         char errorMessage[256];
@@ -62,6 +369,8 @@ namespace VST1Bridge {
             float paramValue;
             int32_t intValue;
         };
+        char text[64];          // string results, e.g. a parameter name
+        int32_t pluginUniqueID; // LoadPlugin: AEffect::uniqueID of the plugin that loaded
     };
 
 } // namespace VST1Bridge
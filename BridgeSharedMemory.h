@@ -0,0 +1,238 @@
+// ==============================================================================
+// FILE: BridgeSharedMemory.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include "BridgeProtocol.h"
+
+#if JUCE_WINDOWS
+ #ifndef NOMINMAX
+  #define NOMINMAX
+ #endif
+ #ifndef WIN32_LEAN_AND_MEAN
+  #define WIN32_LEAN_AND_MEAN
+ #endif
+ #include <windows.h>
+#else
+ #include <fcntl.h>
+ #include <sys/mman.h>
+ #include <unistd.h>
+#endif
+
+namespace VST1Bridge {
+
+    // Named block of memory mapped into both the host and the bridge process.
+    // The host creates the region, the bridge opens it by name.
+    class SharedMemoryRegion
+    {
+    public:
+        SharedMemoryRegion() = default;
+        ~SharedMemoryRegion() { close(); }
+
+        bool create(const juce::String& name, size_t numBytes)
+        {
+            close();
+
+           #if JUCE_WINDOWS
+            const auto size64 = (uint64_t)numBytes;
+            handle = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+                (DWORD)(size64 >> 32), (DWORD)(size64 & 0xffffffff),
+                getSystemName(name).toWideCharPointer());
+
+            if (handle == nullptr)
+                return false;
+
+            if (GetLastError() == ERROR_ALREADY_EXISTS)
+            {
+                close();
+                return false;
+            }
+           #else
+            const auto systemName = getSystemName(name);
+            fd = shm_open(systemName.toRawUTF8(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+            if (fd < 0)
+                return false;
+
+            ownsName = true;
+            posixName = systemName;
+
+            if (ftruncate(fd, (off_t)numBytes) != 0)
+            {
+                close();
+                return false;
+            }
+           #endif
+
+            return map(numBytes);
+        }
+
+        bool open(const juce::String& name, size_t numBytes)
+        {
+            close();
+
+           #if JUCE_WINDOWS
+            handle = OpenFileMappingW(FILE_MAP_ALL_ACCESS, FALSE, getSystemName(name).toWideCharPointer());
+
+            if (handle == nullptr)
+                return false;
+           #else
+            fd = shm_open(getSystemName(name).toRawUTF8(), O_RDWR, 0600);
+
+            if (fd < 0)
+                return false;
+           #endif
+
+            return map(numBytes);
+        }
+
+        void close()
+        {
+           #if JUCE_WINDOWS
+            if (data != nullptr)
+                UnmapViewOfFile(data);
+
+            if (handle != nullptr)
+                CloseHandle(handle);
+
+            handle = nullptr;
+           #else
+            if (data != nullptr)
+                munmap(data, size);
+
+            if (fd >= 0)
+                ::close(fd);
+
+            if (ownsName)
+                shm_unlink(posixName.toRawUTF8());
+
+            fd = -1;
+            ownsName = false;
+            posixName.clear();
+           #endif
+
+            data = nullptr;
+            size = 0;
+        }
+
+        bool isOpen() const noexcept { return data != nullptr; }
+        void* getData() const noexcept { return data; }
+        size_t getSize() const noexcept { return size; }
+
+    private:
+        bool map(size_t numBytes)
+        {
+           #if JUCE_WINDOWS
+            data = MapViewOfFile(handle, FILE_MAP_ALL_ACCESS, 0, 0, numBytes);
+           #else
+            data = mmap(nullptr, numBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+            if (data == MAP_FAILED)
+                data = nullptr;
+           #endif
+
+            if (data == nullptr)
+            {
+                close();
+                return false;
+            }
+
+            size = numBytes;
+            return true;
+        }
+
+        static juce::String getSystemName(const juce::String& name)
+        {
+           #if JUCE_WINDOWS
+            return "Local\\" + name;
+           #else
+            // POSIX shm names are limited to 31 characters on macOS
+            return "/vb1_" + juce::String::toHexString(name.hashCode64());
+           #endif
+        }
+
+        void* data = nullptr;
+        size_t size = 0;
+
+       #if JUCE_WINDOWS
+        HANDLE handle = nullptr;
+       #else
+        int fd = -1;
+        bool ownsName = false;
+        juce::String posixName;
+       #endif
+
+        JUCE_DECLARE_NON_COPYABLE(SharedMemoryRegion)
+    };
+
+    // Typed view over a mapped SharedAudioHeader region
+    struct SharedAudioView
+    {
+        SharedAudioHeader* header = nullptr;
+        char* inputs = nullptr;
+        char* outputs = nullptr;
+
+        static SharedAudioView fromRegion(const SharedMemoryRegion& region)
+        {
+            SharedAudioView view;
+
+            if (!region.isOpen() || region.getSize() < sizeof(SharedAudioHeader))
+                return view;
+
+            auto* base = static_cast<char*>(region.getData());
+            auto* header = reinterpret_cast<SharedAudioHeader*>(base);
+
+            if (header->magic != kSharedAudioMagic
+                || header->numSlots < 1 || header->numSlots > (uint32_t)kMaxPipelineSlots
+                || (header->sampleSize != sizeof(float) && header->sampleSize != sizeof(double))
+                || region.getSize() < getSharedAudioSize((int32_t)header->maxChannels,
+                                                         (int32_t)header->maxSamples,
+                                                         (int32_t)header->numSlots,
+                                                         (int32_t)header->sampleSize))
+                return view;
+
+            view.header = header;
+            view.inputs = base + sizeof(SharedAudioHeader);
+            view.outputs = view.inputs + header->numSlots * view.getBytesPerSlot();
+            return view;
+        }
+
+        bool isValid() const noexcept { return header != nullptr; }
+
+        int getNumSlots() const noexcept { return header != nullptr ? (int)header->numSlots : 0; }
+        size_t getBytesPerSlot() const noexcept { return (size_t)header->maxChannels * header->maxSamples * header->sampleSize; }
+
+        template <typename SampleType>
+        bool holds() const noexcept { return header != nullptr && header->sampleSize == sizeof(SampleType); }
+
+        // Start of a slot's samples, for AudioLayout::Interleaved
+        template <typename SampleType = float>
+        SampleType* getInputs(int slot) const noexcept
+        {
+            jassert(holds<SampleType>());
+            return reinterpret_cast<SampleType*>(inputs + (size_t)slot * getBytesPerSlot());
+        }
+
+        template <typename SampleType = float>
+        SampleType* getOutputs(int slot) const noexcept
+        {
+            jassert(holds<SampleType>());
+            return reinterpret_cast<SampleType*>(outputs + (size_t)slot * getBytesPerSlot());
+        }
+
+        // Channel runs for AudioLayout::Planar
+        template <typename SampleType = float>
+        SampleType* getInputChannel(int slot, int channel) const noexcept { return getInputs<SampleType>(slot) + (size_t)channel * header->maxSamples; }
+
+        template <typename SampleType = float>
+        SampleType* getOutputChannel(int slot, int channel) const noexcept { return getOutputs<SampleType>(slot) + (size_t)channel * header->maxSamples; }
+
+        bool canHold(int numChannels, int numSamples) const noexcept
+        {
+            return header != nullptr
+                && numChannels <= (int)header->maxChannels
+                && numSamples <= (int)header->maxSamples;
+        }
+    };
+
+} // namespace VST1Bridge
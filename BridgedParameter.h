@@ -0,0 +1,118 @@
+// ==============================================================================
+// FILE: BridgedParameter.h
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include "BridgeProtocol.h"
+
+// Which parameter slots the host changed since the last block, so the audio thread
+// only visits those instead of every slot
+class PendingParameterChanges
+{
+public:
+    void mark(int index) noexcept
+    {
+        bits[index / 32].fetch_or(1u << (index % 32), std::memory_order_release);
+    }
+
+    void clear(int index) noexcept
+    {
+        bits[index / 32].fetch_and(~(1u << (index % 32)), std::memory_order_relaxed);
+    }
+
+    // Calls back once for each slot marked since the last call
+    template <typename Callback>
+    void take(Callback&& callback) noexcept
+    {
+        for (int word = 0; word < numWords; ++word)
+        {
+            auto pending = bits[word].exchange(0, std::memory_order_acquire);
+
+            for (int bit = 0; pending != 0; ++bit, pending >>= 1)
+                if ((pending & 1) != 0)
+                    callback(word * 32 + bit);
+        }
+    }
+
+private:
+    static constexpr int numWords = VST1Bridge::kMaxBridgedParameters / 32;
+    std::atomic<uint32_t> bits[numWords] {};
+};
+
+// One of the bridged plugin's parameters, exposed to the host. Hosts need a fixed
+// parameter list, so VST1BridgeProcessor creates a fixed number of these and maps
+// them onto whatever the loaded plugin has; spare slots stay unnamed.
+class BridgedParameter : public juce::AudioProcessorParameterWithID
+{
+public:
+    BridgedParameter(int index, PendingParameterChanges& pendingChanges)
+        : juce::AudioProcessorParameterWithID(juce::ParameterID("param" + juce::String(index), 1),
+                                              "Param " + juce::String(index + 1)),
+          slotIndex(index),
+          slotName("Param " + juce::String(index + 1)),
+          pending(pendingChanges)
+    {
+    }
+
+    float getValue() const override { return value.load(); }
+
+    // Any thread: the change is only recorded here and queued to the bridge by the next block
+    void setValue(float newValue) override
+    {
+        value = newValue;
+        pending.mark(slotIndex);
+    }
+
+    float getDefaultValue() const override { return 0.0f; }
+
+    juce::String getName(int maximumStringLength) const override
+    {
+        const juce::SpinLock::ScopedLockType sl(nameLock);
+        return (pluginName.isNotEmpty() ? pluginName : slotName).substring(0, maximumStringLength);
+    }
+
+    juce::String getLabel() const override
+    {
+        const juce::SpinLock::ScopedLockType sl(nameLock);
+        return pluginLabel;
+    }
+
+    float getValueForText(const juce::String& text) const override { return text.getFloatValue(); }
+
+    // Called after a plugin load; never queued back to the plugin
+    void setPluginInfo(const juce::String& name, const juce::String& label, float currentValue)
+    {
+        {
+            const juce::SpinLock::ScopedLockType sl(nameLock);
+            pluginName = name.isNotEmpty() ? name : slotName;
+            pluginLabel = label;
+        }
+
+        value = currentValue;
+        pending.clear(slotIndex);
+    }
+
+    // The plugin changed the value itself, e.g. from its own editor
+    void updateFromPlugin(float newValue)
+    {
+        value = newValue;
+        sendValueChangedMessageToListeners(newValue);
+    }
+
+    void clearPluginInfo()
+    {
+        const juce::SpinLock::ScopedLockType sl(nameLock);
+        pluginName.clear();
+        pluginLabel.clear();
+    }
+
+private:
+    const int slotIndex;
+    const juce::String slotName;
+    juce::String pluginName, pluginLabel;
+    juce::SpinLock nameLock;
+    std::atomic<float> value { 0.0f };
+    PendingParameterChanges& pending;
+
+    JUCE_DECLARE_NON_COPYABLE(BridgedParameter)
+};
@@ -0,0 +1,569 @@
+// ==============================================================================
+// FILE: InterleaveKernels.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include <cstring>
+
+#if JUCE_INTEL
+ #include <immintrin.h>
+ #if JUCE_MSVC
+  #define VST1BRIDGE_AVX2_TARGET
+ #else
+  #define VST1BRIDGE_AVX2_TARGET __attribute__((target("avx2")))
+ #endif
+#elif JUCE_ARM && defined(__ARM_NEON)
+ #include <arm_neon.h>
+ #define VST1BRIDGE_USE_NEON 1
+#endif
+
+// Interleave/deinterleave kernels for the AudioLayout::Interleaved wire format.
+// 1, 2, 4, 6 and 8 channels get dedicated kernels, everything else (and every
+// tail shorter than a vector) goes through the scalar loop. The best variant
+// for the running CPU is picked once, on first use.
+namespace VST1Bridge {
+namespace Interleave {
+
+    using InterleaveFn = void (*)(const float* const* src, float* dst, int numSamples);
+    using DeinterleaveFn = void (*)(const float* src, float* const* dst, int numSamples);
+
+    constexpr int maxSpecialisedChannels = 8;
+
+    //==============================================================================
+    namespace Scalar {
+
+        inline void interleave(const float* const* src, float* dst, int numChannels, int start, int numSamples)
+        {
+            for (int i = start; i < numSamples; ++i)
+                for (int ch = 0; ch < numChannels; ++ch)
+                    dst[i * numChannels + ch] = src[ch][i];
+        }
+
+        inline void deinterleave(const float* src, float* const* dst, int numChannels, int start, int numSamples)
+        {
+            for (int i = start; i < numSamples; ++i)
+                for (int ch = 0; ch < numChannels; ++ch)
+                    dst[ch][i] = src[i * numChannels + ch];
+        }
+
+        template <int NumChannels>
+        void interleaveN(const float* const* src, float* dst, int numSamples)
+        {
+            interleave(src, dst, NumChannels, 0, numSamples);
+        }
+
+        template <int NumChannels>
+        void deinterleaveN(const float* src, float* const* dst, int numSamples)
+        {
+            deinterleave(src, dst, NumChannels, 0, numSamples);
+        }
+
+    } // namespace Scalar
+
+    inline void copyMono(const float* const* src, float* dst, int numSamples)
+    {
+        std::memcpy(dst, src[0], (size_t)numSamples * sizeof(float));
+    }
+
+    inline void copyMono(const float* src, float* const* dst, int numSamples)
+    {
+        std::memcpy(dst[0], src, (size_t)numSamples * sizeof(float));
+    }
+
+   #if JUCE_INTEL
+    //==============================================================================
+    namespace SSE2 {
+
+        inline void interleave2(const float* const* src, float* dst, int numSamples)
+        {
+            const float* l = src[0];
+            const float* r = src[1];
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const __m128 a = _mm_loadu_ps(l + i);
+                const __m128 b = _mm_loadu_ps(r + i);
+                _mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(a, b));
+                _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(a, b));
+            }
+
+            Scalar::interleave(src, dst, 2, i, numSamples);
+        }
+
+        inline void deinterleave2(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const __m128 a = _mm_loadu_ps(src + 2 * i);
+                const __m128 b = _mm_loadu_ps(src + 2 * i + 4);
+                _mm_storeu_ps(dst[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(dst[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+
+            Scalar::deinterleave(src, dst, 2, i, numSamples);
+        }
+
+        // Four frames of channels [first, first + 4) transposed into four frame vectors
+        inline void loadTransposed(const float* const* src, int first, int i, __m128 (&rows)[4])
+        {
+            for (int r = 0; r < 4; ++r)
+                rows[r] = _mm_loadu_ps(src[first + r] + i);
+
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+        }
+
+        inline void storeTransposed(float* const* dst, int first, int i, __m128 (&rows)[4])
+        {
+            _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+
+            for (int r = 0; r < 4; ++r)
+                _mm_storeu_ps(dst[first + r] + i, rows[r]);
+        }
+
+        inline void interleave4(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                __m128 frames[4];
+                loadTransposed(src, 0, i, frames);
+
+                for (int f = 0; f < 4; ++f)
+                    _mm_storeu_ps(dst + (i + f) * 4, frames[f]);
+            }
+
+            Scalar::interleave(src, dst, 4, i, numSamples);
+        }
+
+        inline void deinterleave4(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                __m128 frames[4];
+
+                for (int f = 0; f < 4; ++f)
+                    frames[f] = _mm_loadu_ps(src + (i + f) * 4);
+
+                storeTransposed(dst, 0, i, frames);
+            }
+
+            Scalar::deinterleave(src, dst, 4, i, numSamples);
+        }
+
+        inline void interleave6(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                __m128 frames[4];
+                loadTransposed(src, 0, i, frames);
+
+                const __m128 c4 = _mm_loadu_ps(src[4] + i);
+                const __m128 c5 = _mm_loadu_ps(src[5] + i);
+                const __m128 pairs01 = _mm_unpacklo_ps(c4, c5);
+                const __m128 pairs23 = _mm_unpackhi_ps(c4, c5);
+
+                float* out = dst + i * 6;
+                _mm_storeu_ps(out, frames[0]);
+                _mm_storel_pi(reinterpret_cast<__m64*>(out + 4), pairs01);
+                _mm_storeu_ps(out + 6, frames[1]);
+                _mm_storeh_pi(reinterpret_cast<__m64*>(out + 10), pairs01);
+                _mm_storeu_ps(out + 12, frames[2]);
+                _mm_storel_pi(reinterpret_cast<__m64*>(out + 16), pairs23);
+                _mm_storeu_ps(out + 18, frames[3]);
+                _mm_storeh_pi(reinterpret_cast<__m64*>(out + 22), pairs23);
+            }
+
+            Scalar::interleave(src, dst, 6, i, numSamples);
+        }
+
+        inline void deinterleave6(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const float* in = src + i * 6;
+                __m128 frames[4];
+
+                for (int f = 0; f < 4; ++f)
+                    frames[f] = _mm_loadu_ps(in + f * 6);
+
+                storeTransposed(dst, 0, i, frames);
+
+                __m128 pairs01 = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(in + 4));
+                pairs01 = _mm_loadh_pi(pairs01, reinterpret_cast<const __m64*>(in + 10));
+                __m128 pairs23 = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64*>(in + 16));
+                pairs23 = _mm_loadh_pi(pairs23, reinterpret_cast<const __m64*>(in + 22));
+
+                _mm_storeu_ps(dst[4] + i, _mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(dst[5] + i, _mm_shuffle_ps(pairs01, pairs23, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+
+            Scalar::deinterleave(src, dst, 6, i, numSamples);
+        }
+
+        inline void interleave8(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                __m128 low[4], high[4];
+                loadTransposed(src, 0, i, low);
+                loadTransposed(src, 4, i, high);
+
+                for (int f = 0; f < 4; ++f)
+                {
+                    _mm_storeu_ps(dst + (i + f) * 8, low[f]);
+                    _mm_storeu_ps(dst + (i + f) * 8 + 4, high[f]);
+                }
+            }
+
+            Scalar::interleave(src, dst, 8, i, numSamples);
+        }
+
+        inline void deinterleave8(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                __m128 low[4], high[4];
+
+                for (int f = 0; f < 4; ++f)
+                {
+                    low[f] = _mm_loadu_ps(src + (i + f) * 8);
+                    high[f] = _mm_loadu_ps(src + (i + f) * 8 + 4);
+                }
+
+                storeTransposed(dst, 0, i, low);
+                storeTransposed(dst, 4, i, high);
+            }
+
+            Scalar::deinterleave(src, dst, 8, i, numSamples);
+        }
+
+    } // namespace SSE2
+
+    //==============================================================================
+    // Only stereo and 8 channels gain from 256-bit lanes; the rest reuse SSE2
+    namespace AVX2 {
+
+        VST1BRIDGE_AVX2_TARGET inline void interleave2(const float* const* src, float* dst, int numSamples)
+        {
+            const float* l = src[0];
+            const float* r = src[1];
+            int i = 0;
+
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                const __m256 a = _mm256_loadu_ps(l + i);
+                const __m256 b = _mm256_loadu_ps(r + i);
+                const __m256 lo = _mm256_unpacklo_ps(a, b);
+                const __m256 hi = _mm256_unpackhi_ps(a, b);
+                _mm256_storeu_ps(dst + 2 * i, _mm256_permute2f128_ps(lo, hi, 0x20));
+                _mm256_storeu_ps(dst + 2 * i + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+            }
+
+            Scalar::interleave(src, dst, 2, i, numSamples);
+        }
+
+        VST1BRIDGE_AVX2_TARGET inline void deinterleave2(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                const __m256 a = _mm256_loadu_ps(src + 2 * i);
+                const __m256 b = _mm256_loadu_ps(src + 2 * i + 8);
+                const __m256 lo = _mm256_permute2f128_ps(a, b, 0x20);
+                const __m256 hi = _mm256_permute2f128_ps(a, b, 0x31);
+                _mm256_storeu_ps(dst[0] + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm256_storeu_ps(dst[1] + i, _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+
+            Scalar::deinterleave(src, dst, 2, i, numSamples);
+        }
+
+        VST1BRIDGE_AVX2_TARGET inline void transpose8x8(__m256 (&rows)[8])
+        {
+            __m256 t[8], u[8];
+
+            for (int k = 0; k < 4; ++k)
+            {
+                t[2 * k] = _mm256_unpacklo_ps(rows[2 * k], rows[2 * k + 1]);
+                t[2 * k + 1] = _mm256_unpackhi_ps(rows[2 * k], rows[2 * k + 1]);
+            }
+
+            for (int k = 0; k < 2; ++k)
+            {
+                u[4 * k + 0] = _mm256_shuffle_ps(t[4 * k], t[4 * k + 2], _MM_SHUFFLE(1, 0, 1, 0));
+                u[4 * k + 1] = _mm256_shuffle_ps(t[4 * k], t[4 * k + 2], _MM_SHUFFLE(3, 2, 3, 2));
+                u[4 * k + 2] = _mm256_shuffle_ps(t[4 * k + 1], t[4 * k + 3], _MM_SHUFFLE(1, 0, 1, 0));
+                u[4 * k + 3] = _mm256_shuffle_ps(t[4 * k + 1], t[4 * k + 3], _MM_SHUFFLE(3, 2, 3, 2));
+            }
+
+            for (int k = 0; k < 4; ++k)
+            {
+                rows[k] = _mm256_permute2f128_ps(u[k], u[k + 4], 0x20);
+                rows[k + 4] = _mm256_permute2f128_ps(u[k], u[k + 4], 0x31);
+            }
+        }
+
+        VST1BRIDGE_AVX2_TARGET inline void interleave8(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m256 rows[8];
+
+                for (int ch = 0; ch < 8; ++ch)
+                    rows[ch] = _mm256_loadu_ps(src[ch] + i);
+
+                transpose8x8(rows);
+
+                for (int f = 0; f < 8; ++f)
+                    _mm256_storeu_ps(dst + (i + f) * 8, rows[f]);
+            }
+
+            Scalar::interleave(src, dst, 8, i, numSamples);
+        }
+
+        VST1BRIDGE_AVX2_TARGET inline void deinterleave8(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 8 <= numSamples; i += 8)
+            {
+                __m256 rows[8];
+
+                for (int f = 0; f < 8; ++f)
+                    rows[f] = _mm256_loadu_ps(src + (i + f) * 8);
+
+                transpose8x8(rows);
+
+                for (int ch = 0; ch < 8; ++ch)
+                    _mm256_storeu_ps(dst[ch] + i, rows[ch]);
+            }
+
+            Scalar::deinterleave(src, dst, 8, i, numSamples);
+        }
+
+    } // namespace AVX2
+   #endif
+
+   #if VST1BRIDGE_USE_NEON
+    //==============================================================================
+    // vst2/vst4 and vld2/vld4 do the shuffle in hardware; 6 and 8 stay scalar
+    namespace NEON {
+
+        inline void interleave2(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+                vst2q_f32(dst + 2 * i, float32x4x2_t { { vld1q_f32(src[0] + i), vld1q_f32(src[1] + i) } });
+
+            Scalar::interleave(src, dst, 2, i, numSamples);
+        }
+
+        inline void deinterleave2(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const float32x4x2_t v = vld2q_f32(src + 2 * i);
+                vst1q_f32(dst[0] + i, v.val[0]);
+                vst1q_f32(dst[1] + i, v.val[1]);
+            }
+
+            Scalar::deinterleave(src, dst, 2, i, numSamples);
+        }
+
+        inline void interleave4(const float* const* src, float* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+                vst4q_f32(dst + 4 * i, float32x4x4_t { { vld1q_f32(src[0] + i), vld1q_f32(src[1] + i),
+                                                         vld1q_f32(src[2] + i), vld1q_f32(src[3] + i) } });
+
+            Scalar::interleave(src, dst, 4, i, numSamples);
+        }
+
+        inline void deinterleave4(const float* src, float* const* dst, int numSamples)
+        {
+            int i = 0;
+
+            for (; i + 4 <= numSamples; i += 4)
+            {
+                const float32x4x4_t v = vld4q_f32(src + 4 * i);
+
+                for (int ch = 0; ch < 4; ++ch)
+                    vst1q_f32(dst[ch] + i, v.val[ch]);
+            }
+
+            Scalar::deinterleave(src, dst, 4, i, numSamples);
+        }
+
+    } // namespace NEON
+   #endif
+
+    //==============================================================================
+    struct KernelTable
+    {
+        const char* name;
+        InterleaveFn interleave[maxSpecialisedChannels + 1];
+        DeinterleaveFn deinterleave[maxSpecialisedChannels + 1];
+    };
+
+    inline KernelTable makeScalarTable()
+    {
+        return { "scalar",
+                 { nullptr, copyMono, Scalar::interleaveN<2>, Scalar::interleaveN<3>, Scalar::interleaveN<4>,
+                   Scalar::interleaveN<5>, Scalar::interleaveN<6>, Scalar::interleaveN<7>, Scalar::interleaveN<8> },
+                 { nullptr, copyMono, Scalar::deinterleaveN<2>, Scalar::deinterleaveN<3>, Scalar::deinterleaveN<4>,
+                   Scalar::deinterleaveN<5>, Scalar::deinterleaveN<6>, Scalar::deinterleaveN<7>, Scalar::deinterleaveN<8> } };
+    }
+
+    inline KernelTable makeBestTable()
+    {
+        auto table = makeScalarTable();
+
+       #if JUCE_INTEL
+        if (juce::SystemStats::hasSSE2())
+        {
+            table.name = "sse2";
+            table.interleave[2] = SSE2::interleave2;
+            table.interleave[4] = SSE2::interleave4;
+            table.interleave[6] = SSE2::interleave6;
+            table.interleave[8] = SSE2::interleave8;
+            table.deinterleave[2] = SSE2::deinterleave2;
+            table.deinterleave[4] = SSE2::deinterleave4;
+            table.deinterleave[6] = SSE2::deinterleave6;
+            table.deinterleave[8] = SSE2::deinterleave8;
+        }
+
+        if (juce::SystemStats::hasAVX2())
+        {
+            table.name = "avx2";
+            table.interleave[2] = AVX2::interleave2;
+            table.interleave[8] = AVX2::interleave8;
+            table.deinterleave[2] = AVX2::deinterleave2;
+            table.deinterleave[8] = AVX2::deinterleave8;
+        }
+       #elif VST1BRIDGE_USE_NEON
+        table.name = "neon";
+        table.interleave[2] = NEON::interleave2;
+        table.interleave[4] = NEON::interleave4;
+        table.deinterleave[2] = NEON::deinterleave2;
+        table.deinterleave[4] = NEON::deinterleave4;
+       #endif
+
+        return table;
+    }
+
+    inline const KernelTable& getKernels()
+    {
+        static const KernelTable table = makeBestTable();
+        return table;
+    }
+
+    //==============================================================================
+    inline void interleave(const float* const* src, float* dst, int numChannels, int numSamples)
+    {
+        if (numChannels > 0 && numChannels <= maxSpecialisedChannels)
+            getKernels().interleave[numChannels](src, dst, numSamples);
+        else
+            Scalar::interleave(src, dst, numChannels, 0, numSamples);
+    }
+
+    inline void deinterleave(const float* src, float* const* dst, int numChannels, int numSamples)
+    {
+        if (numChannels > 0 && numChannels <= maxSpecialisedChannels)
+            getKernels().deinterleave[numChannels](src, dst, numSamples);
+        else
+            Scalar::deinterleave(src, dst, numChannels, 0, numSamples);
+    }
+
+    // Double-precision blocks only come from 64-bit mastering chains, the scalar loop is enough
+    inline void interleave(const double* const* src, double* dst, int numChannels, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            for (int ch = 0; ch < numChannels; ++ch)
+                dst[i * numChannels + ch] = src[ch][i];
+    }
+
+    inline void deinterleave(const double* src, double* const* dst, int numChannels, int numSamples)
+    {
+        for (int i = 0; i < numSamples; ++i)
+            for (int ch = 0; ch < numChannels; ++ch)
+                dst[ch][i] = src[i * numChannels + ch];
+    }
+
+    //==============================================================================
+    // Micro-benchmark: throughput of the selected kernels against the scalar
+    // loop for every specialised channel count (VST1Bridge32 --benchmark-interleave)
+    inline juce::String runBenchmark(int blockSize = 512, int iterations = 20000)
+    {
+        const auto scalar = makeScalarTable();
+        const auto& best = getKernels();
+        const int channelCounts[] = { 1, 2, 4, 6, 8 };
+
+        juce::HeapBlock<float> planar, interleaved;
+        juce::HeapBlock<float*> channels;
+        planar.allocate((size_t)maxSpecialisedChannels * blockSize, true);
+        interleaved.allocate((size_t)maxSpecialisedChannels * blockSize, true);
+        channels.calloc(maxSpecialisedChannels);
+
+        for (int ch = 0; ch < maxSpecialisedChannels; ++ch)
+        {
+            channels[ch] = planar + ch * blockSize;
+
+            for (int i = 0; i < blockSize; ++i)
+                channels[ch][i] = (float)(ch * blockSize + i);
+        }
+
+        // Mega-samples (frames x channels) per second for one interleave + deinterleave round trip
+        auto measure = [&](const KernelTable& table, int numChannels)
+        {
+            const auto start = juce::Time::getHighResolutionTicks();
+
+            for (int n = 0; n < iterations; ++n)
+            {
+                table.interleave[numChannels](channels, interleaved, blockSize);
+                table.deinterleave[numChannels](interleaved, channels, blockSize);
+            }
+
+            const auto seconds = juce::Time::highResolutionTicksToSeconds(juce::Time::getHighResolutionTicks() - start);
+            return (double)iterations * blockSize * numChannels / juce::jmax(seconds, 1.0e-9) / 1.0e6;
+        };
+
+        juce::String report;
+        report << "Interleave kernels: " << best.name << ", block size " << blockSize << "\n";
+
+        for (auto numChannels : channelCounts)
+        {
+            const auto scalarRate = measure(scalar, numChannels);
+            const auto bestRate = measure(best, numChannels);
+
+            report << "  " << numChannels << " ch: scalar " << juce::String(scalarRate, 1) << " MS/s, "
+                   << best.name << " " << juce::String(bestRate, 1) << " MS/s ("
+                   << juce::String(bestRate / juce::jmax(scalarRate, 1.0e-9), 2) << "x)\n";
+        }
+
+        return report;
+    }
+
+} // namespace Interleave
+} // namespace VST1Bridge
@@ -0,0 +1,80 @@
+// ==============================================================================
+// FILE: PluginDescription.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+
+namespace VST1Bridge {
+
+    // Exit codes of a --probe run that didn't crash
+    constexpr int kProbeExitNotAPlugin = 1;     // the DLL loaded, but is no usable plugin
+    constexpr int kProbeExitNoResult = 2;       // the plugin is fine, the result file couldn't be written
+
+    // What a probe learns about a plugin DLL. The bridge writes it as one XML element
+    // to the result file named in --probe mode; the host keeps the same element in its scan index.
+    struct PluginDescription {
+        static constexpr const char* xmlTag = "Plugin";
+
+        juce::String path;
+        juce::String name;
+        juce::String vendor;
+        juce::String product;
+        juce::String category;      // VstPlugCategory, spelled out
+        int32_t uniqueID = 0;
+        int32_t version = 0;        // AEffect::version
+        int32_t vendorVersion = 0;
+        int32_t vstVersion = 0;     // effGetVstVersion, 0 for VST 1.0
+        int32_t numInputs = 0;
+        int32_t numOutputs = 0;
+        int32_t numParams = 0;
+        int32_t numPrograms = 0;
+        bool isSynth = false;       // effFlagsIsSynth
+        bool hasChunks = false;     // effFlagsProgramChunks
+        double loadTimeMs = 0.0;    // DLL load, entry point and effOpen
+
+        void writeTo(juce::XmlElement& xml) const
+        {
+            xml.setAttribute("path", path);
+            xml.setAttribute("name", name);
+            xml.setAttribute("vendor", vendor);
+            xml.setAttribute("product", product);
+            xml.setAttribute("category", category);
+            xml.setAttribute("uniqueID", (int)uniqueID);
+            xml.setAttribute("version", (int)version);
+            xml.setAttribute("vendorVersion", (int)vendorVersion);
+            xml.setAttribute("vstVersion", (int)vstVersion);
+            xml.setAttribute("numInputs", (int)numInputs);
+            xml.setAttribute("numOutputs", (int)numOutputs);
+            xml.setAttribute("numParams", (int)numParams);
+            xml.setAttribute("numPrograms", (int)numPrograms);
+            xml.setAttribute("isSynth", isSynth);
+            xml.setAttribute("hasChunks", hasChunks);
+            xml.setAttribute("loadTimeMs", loadTimeMs);
+        }
+
+        bool readFrom(const juce::XmlElement& xml)
+        {
+            if (!xml.hasTagName(xmlTag))
+                return false;
+
+            path = xml.getStringAttribute("path");
+            name = xml.getStringAttribute("name");
+            vendor = xml.getStringAttribute("vendor");
+            product = xml.getStringAttribute("product");
+            category = xml.getStringAttribute("category");
+            uniqueID = xml.getIntAttribute("uniqueID");
+            version = xml.getIntAttribute("version");
+            vendorVersion = xml.getIntAttribute("vendorVersion");
+            vstVersion = xml.getIntAttribute("vstVersion");
+            numInputs = xml.getIntAttribute("numInputs");
+            numOutputs = xml.getIntAttribute("numOutputs");
+            numParams = xml.getIntAttribute("numParams");
+            numPrograms = xml.getIntAttribute("numPrograms");
+            isSynth = xml.getBoolAttribute("isSynth");
+            hasChunks = xml.getBoolAttribute("hasChunks");
+            loadTimeMs = xml.getDoubleAttribute("loadTimeMs");
+            return path.isNotEmpty();
+        }
+    };
+
+} // namespace VST1Bridge
@@ -6,12 +6,44 @@
 VST1BridgeEditor::VST1BridgeEditor(VST1BridgeProcessor& p)
     : AudioProcessorEditor(&p), processor(p)
 {
-    setSize(400, 200);
+    setSize(400, 326);
 
     loadButton.setButtonText("Load VST1 Plugin...");
     loadButton.onClick = [this] { loadButtonClicked(); };
     addAndMakeVisible(loadButton);
 
+    pluginList.setTextWhenNothingSelected("Scanned plugins");
+    pluginList.setTextWhenNoChoicesAvailable("No plugins scanned yet");
+    pluginList.onChange = [this]
+        {
+            const int index = pluginList.getSelectedItemIndex();
+
+            if (juce::isPositiveAndBelow(index, (int)scannedPlugins.size()))
+                loadPlugin(juce::File(scannedPlugins[(size_t)index].path));
+        };
+    addAndMakeVisible(pluginList);
+
+    scanButton.setButtonText("Scan...");
+    scanButton.onClick = [this] { scanButtonClicked(); };
+    addAndMakeVisible(scanButton);
+
+    // Probes the plugins that crashed or hung during a scan again
+    retryBlacklistedButton.onClick = [this] { retryBlacklistedClicked(); };
+    addChildComponent(retryBlacklistedButton);
+
+    PluginScanner::getInstance()->addChangeListener(this);
+    updatePluginList();
+
+    isolateButton.setButtonText("Run in its own bridge process");
+    isolateButton.setToggleState(processor.isIsolated(), juce::dontSendNotification);
+    isolateButton.onClick = [this] { processor.setIsolated(isolateButton.getToggleState()); };
+    addAndMakeVisible(isolateButton);
+
+    pipelineButton.setButtonText("Pipelined processing (+1 block latency)");
+    pipelineButton.setToggleState(processor.isPipelinedProcessing(), juce::dontSendNotification);
+    pipelineButton.onClick = [this] { processor.setPipelinedProcessing(pipelineButton.getToggleState()); };
+    addAndMakeVisible(pipelineButton);
+
     statusLabel.setText("No plugin loaded", juce::dontSendNotification);
     statusLabel.setJustificationType(juce::Justification::centred);
     addAndMakeVisible(statusLabel);
@@ -21,15 +53,40 @@ VST1BridgeEditor::VST1BridgeEditor(VST1BridgeProcessor& p)
     pathLabel.setFont(juce::Font(12.0f));
     addAndMakeVisible(pathLabel);
 
-    if (processor.isPluginLoaded())
-    {
-        statusLabel.setText("Plugin Loaded", juce::dontSendNotification);
-        pathLabel.setText(processor.getLoadedPluginPath(), juce::dontSendNotification);
-    }
+    presetsButton.setButtonText("Presets...");
+    presetsButton.onClick = [this] { presetsButtonClicked(); };
+    addAndMakeVisible(presetsButton);
+
+    previousPresetButton.setButtonText("<");
+    previousPresetButton.onClick = [this] { stepPreset(-1); };
+    addAndMakeVisible(previousPresetButton);
+
+    nextPresetButton.setButtonText(">");
+    nextPresetButton.onClick = [this] { stepPreset(1); };
+    addAndMakeVisible(nextPresetButton);
+
+    savePresetButton.setButtonText("Save...");
+    savePresetButton.onClick = [this] { savePresetButtonClicked(); };
+    addAndMakeVisible(savePresetButton);
+
+    presetLabel.setFont(juce::Font(12.0f));
+    addAndMakeVisible(presetLabel);
+
+    presetBrowser.onIndexed = [this]
+        {
+            currentPreset = -1;
+            presetLabel.setText(juce::String(presetBrowser.getNumPresets()) + " presets", juce::dontSendNotification);
+            updateStatus();
+        };
+
+    // Loads run in the background, also the ones started by a session restore
+    updateStatus();
+    startTimerHz(10);
 }
 
 VST1BridgeEditor::~VST1BridgeEditor()
 {
+    PluginScanner::getInstance()->removeChangeListener(this);
 }
 
 void VST1BridgeEditor::paint(juce::Graphics& g)
@@ -48,14 +105,96 @@ void VST1BridgeEditor::resized()
     area.removeFromTop(40); // Title space
 
     loadButton.setBounds(area.removeFromTop(40).reduced(50, 5));
+
+    auto pluginRow = area.removeFromTop(30).reduced(0, 2);
+    scanButton.setBounds(pluginRow.removeFromRight(110));
+
+    if (retryBlacklistedButton.isVisible())
+        retryBlacklistedButton.setBounds(pluginRow.removeFromRight(76).withTrimmedRight(6));
+
+    pluginList.setBounds(pluginRow.withTrimmedRight(6));
+    area.removeFromTop(6);
+    isolateButton.setBounds(area.removeFromTop(24).reduced(50, 0));
+    pipelineButton.setBounds(area.removeFromTop(24).reduced(50, 0));
+    area.removeFromTop(6);
+
+    auto presetRow = area.removeFromTop(30);
+    presetsButton.setBounds(presetRow.removeFromLeft(80));
+    previousPresetButton.setBounds(presetRow.removeFromLeft(30));
+    nextPresetButton.setBounds(presetRow.removeFromLeft(30));
+    savePresetButton.setBounds(presetRow.removeFromRight(60));
+    presetLabel.setBounds(presetRow.reduced(6, 0));
+
     area.removeFromTop(10);
     statusLabel.setBounds(area.removeFromTop(30));
     area.removeFromTop(5);
     pathLabel.setBounds(area.removeFromTop(60));
 }
 
+void VST1BridgeEditor::timerCallback()
+{
+    updateStatus();
+}
+
+void VST1BridgeEditor::updateStatus()
+{
+    using LoadState = VST1BridgeProcessor::LoadState;
+    const auto state = processor.getLoadState();
+    const bool isLoading = state == LoadState::StartingBridge || state == LoadState::LoadingPlugin;
+
+    juce::String status;
+
+    switch (state)
+    {
+    case LoadState::StartingBridge: status = "Starting bridge..."; break;
+    case LoadState::LoadingPlugin:  status = "Loading plugin..."; break;
+    case LoadState::Failed:         status = "Failed to load plugin"; break;
+    case LoadState::Cancelled:      status = "Load cancelled"; break;
+    case LoadState::Idle:
+    case LoadState::Loaded:
+    default:
+        status = processor.isPluginLoaded() ? "Plugin Loaded" : "No plugin loaded";
+        break;
+    }
+
+    const auto pluginPath = processor.getLoadedPluginPath();
+    const bool canUsePresets = processor.isPluginLoaded() && !isLoading;
+    previousPresetButton.setEnabled(canUsePresets && presetBrowser.getNumPresets() > 0);
+    nextPresetButton.setEnabled(canUsePresets && presetBrowser.getNumPresets() > 0);
+    savePresetButton.setEnabled(canUsePresets);
+
+    auto* scanner = PluginScanner::getInstance();
+    const auto scan = scanner->getProgress();
+    scanButton.setButtonText(scanner->isScanning()
+        ? juce::String(scan.numProbed) + "/" + juce::String(scan.numToProbe)
+            + ", " + juce::String(scan.getProbesPerSecond(), 1) + "/s"
+        : juce::String("Scan..."));
+
+    const int numBlacklisted = scanner->isScanning() ? 0 : scanner->getNumBlacklisted();
+    retryBlacklistedButton.setButtonText("Retry " + juce::String(numBlacklisted));
+
+    if (retryBlacklistedButton.isVisible() != (numBlacklisted > 0))
+    {
+        retryBlacklistedButton.setVisible(numBlacklisted > 0);
+        resized();
+    }
+
+    statusLabel.setText(status, juce::dontSendNotification);
+    pathLabel.setText(pluginPath, juce::dontSendNotification);
+    loadButton.setButtonText(isLoading ? "Cancel" : "Load VST1 Plugin...");
+}
+
 void VST1BridgeEditor::loadButtonClicked()
 {
+    using LoadState = VST1BridgeProcessor::LoadState;
+    const auto state = processor.getLoadState();
+
+    if (state == LoadState::StartingBridge || state == LoadState::LoadingPlugin)
+    {
+        processor.cancelPluginLoad();
+        return;
+    }
+
     auto chooserFlags = juce::FileBrowserComponent::openMode |
         juce::FileBrowserComponent::canSelectFiles;
 
@@ -68,19 +207,167 @@ void VST1BridgeEditor::loadButtonClicked()
             auto selectedFile = chooser.getResult();
 
             if (selectedFile != juce::File{})
-            {
-                if (processor.loadVST1Plugin(selectedFile))
-                {
-                    statusLabel.setText("Plugin Loaded Successfully!", juce::dontSendNotification);
-                    pathLabel.setText(selectedFile.getFullPathName(), juce::dontSendNotification);
-                }
-                else
-                {
-                    statusLabel.setText("Failed to load plugin", juce::dontSendNotification);
-                    juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
-                        "Load Error",
-                        "Failed to load VST1 plugin. Make sure it's a valid 32-bit VST1 DLL.");
-                }
-            }
+                loadPlugin(selectedFile);
+        });
+}
+
+void VST1BridgeEditor::loadPlugin(const juce::File& dllFile)
+{
+    using LoadState = VST1BridgeProcessor::LoadState;
+
+    processor.loadVST1PluginAsync(dllFile,
+        [safeThis = juce::Component::SafePointer<VST1BridgeEditor>(this)](LoadState result)
+        {
+            if (safeThis == nullptr)
+                return;
+
+            safeThis->updateStatus();
+
+            if (result == LoadState::Failed)
+                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
+                    "Load Error",
+                    "Failed to load VST1 plugin. Make sure it's a valid 32-bit VST1 DLL.");
+        });
+
+    updateStatus();
+}
+
+void VST1BridgeEditor::scanButtonClicked()
+{
+    auto* scanner = PluginScanner::getInstance();
+
+    if (scanner->isScanning())
+    {
+        scanner->cancelScan();
+        updateStatus();
+        return;
+    }
+
+    fileChooser = std::make_unique<juce::FileChooser>("Select a folder of plugins to scan",
+        juce::File::getSpecialLocation(juce::File::userDocumentsDirectory));
+
+    fileChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectDirectories,
+        [](const juce::FileChooser& chooser)
+        {
+            auto directory = chooser.getResult();
+
+            if (!directory.isDirectory())
+                return;
+
+            // Folders scanned before are checked again too, that only costs a directory listing
+            auto* scanner = PluginScanner::getInstance();
+            auto folders = scanner->getScannedFolders();
+            folders.addIfNotAlreadyThere(directory);
+            scanner->scan(folders);
+        });
+}
+
+void VST1BridgeEditor::retryBlacklistedClicked()
+{
+    auto* scanner = PluginScanner::getInstance();
+    scanner->clearBlacklist();
+    scanner->rescan();
+    updateStatus();
+}
+
+void VST1BridgeEditor::changeListenerCallback(juce::ChangeBroadcaster*)
+{
+    updatePluginList();
+    updateStatus();
+}
+
+void VST1BridgeEditor::updatePluginList()
+{
+    scannedPlugins = PluginScanner::getInstance()->getPlugins();
+    pluginList.clear(juce::dontSendNotification);
+
+    for (size_t i = 0; i < scannedPlugins.size(); ++i)
+    {
+        const auto& plugin = scannedPlugins[i];
+        auto text = plugin.name;
+
+        if (plugin.vendor.isNotEmpty())
+            text << " (" << plugin.vendor << ")";
+
+        if (plugin.isSynth)
+            text << " [instrument]";
+
+        pluginList.addItem(text, (int)i + 1);
+
+        if (plugin.path == processor.getLoadedPluginPath())
+            pluginList.setSelectedId((int)i + 1, juce::dontSendNotification);
+    }
+}
+
+void VST1BridgeEditor::presetsButtonClicked()
+{
+    auto startDirectory = presetBrowser.getDirectory();
+
+    if (!startDirectory.isDirectory())
+        startDirectory = juce::File::getSpecialLocation(juce::File::userDocumentsDirectory);
+
+    fileChooser = std::make_unique<juce::FileChooser>("Select a folder of .fxp/.fxb presets", startDirectory);
+
+    fileChooser->launchAsync(juce::FileBrowserComponent::openMode | juce::FileBrowserComponent::canSelectDirectories,
+        [this](const juce::FileChooser& chooser)
+        {
+            auto directory = chooser.getResult();
+
+            if (!directory.isDirectory())
+                return;
+
+            presetBrowser.setDirectory(directory);
+            presetLabel.setText("Reading presets...", juce::dontSendNotification);
+        });
+}
+
+void VST1BridgeEditor::stepPreset(int direction)
+{
+    // From no selection, step onto the first or the last preset
+    const int start = currentPreset >= 0 ? currentPreset : (direction > 0 ? -1 : 0);
+    // Only presets the loaded plugin saved
+    const int index = presetBrowser.findNext(start, processor.getLoadedPluginUniqueID(), direction);
+
+    if (index < 0)
+    {
+        presetLabel.setText("No presets for this plugin", juce::dontSendNotification);
+        return;
+    }
+
+    currentPreset = index;
+    const auto file = presetBrowser.getFile(index);
+    const bool loaded = processor.loadPresetFile(file);
+
+    presetLabel.setText(file.getFileNameWithoutExtension() + (loaded ? "" : " (not loaded)"),
+        juce::dontSendNotification);
+}
+
+void VST1BridgeEditor::savePresetButtonClicked()
+{
+    auto startDirectory = presetBrowser.getDirectory();
+
+    if (!startDirectory.isDirectory())
+        startDirectory = juce::File::getSpecialLocation(juce::File::userDocumentsDirectory);
+
+    fileChooser = std::make_unique<juce::FileChooser>("Save the current program (.fxp) or the bank (.fxb)",
+        startDirectory, "*.fxp;*.fxb");
+
+    fileChooser->launchAsync(juce::FileBrowserComponent::saveMode | juce::FileBrowserComponent::canSelectFiles
+            | juce::FileBrowserComponent::warnAboutOverwriting,
+        [this](const juce::FileChooser& chooser)
+        {
+            auto file = chooser.getResult();
+
+            if (file == juce::File{})
+                return;
+
+            const bool asBank = file.hasFileExtension("fxb");
+
+            if (!asBank && !file.hasFileExtension("fxp"))
+                file = file.withFileExtension("fxp");
+
+            if (!processor.savePresetFile(file, asBank))
+                juce::AlertWindow::showMessageBoxAsync(juce::AlertWindow::WarningIcon,
+                    "Save Error", "Failed to save the preset.");
         });
 }
\ No newline at end of file
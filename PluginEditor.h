@@ -4,8 +4,12 @@
 #pragma once
 #include <JuceHeader.h>
 #include "PluginProcessor.h"
+#include "PresetBrowser.h"
+#include "PluginScanner.h"
 
-class VST1BridgeEditor : public juce::AudioProcessorEditor
+class VST1BridgeEditor : public juce::AudioProcessorEditor,
+                         private juce::Timer,
+                         private juce::ChangeListener
 {
 public:
     VST1BridgeEditor(VST1BridgeProcessor&);
@@ -15,13 +19,34 @@ public:
     void resized() override;
 
 private:
+    void timerCallback() override;
+    void changeListenerCallback(juce::ChangeBroadcaster*) override;
     void loadButtonClicked();
+    void scanButtonClicked();
+    void retryBlacklistedClicked();
+    void updatePluginList();
+    void loadPlugin(const juce::File& dllFile);
+    void presetsButtonClicked();
+    void savePresetButtonClicked();
+    void stepPreset(int direction);
+    void updateStatus();
 
     VST1BridgeProcessor& processor;
     juce::TextButton loadButton;
+    juce::ComboBox pluginList;
+    juce::TextButton scanButton;
+    juce::TextButton retryBlacklistedButton;    // only shown while there is a blacklist
+    std::vector<VST1Bridge::PluginDescription> scannedPlugins;
+    juce::ToggleButton isolateButton;
+    juce::ToggleButton pipelineButton;
     juce::Label statusLabel;
     juce::Label pathLabel;
+    juce::TextButton presetsButton, previousPresetButton, nextPresetButton, savePresetButton;
+    juce::Label presetLabel;
     std::unique_ptr<juce::FileChooser> fileChooser;
 
+    PresetBrowser presetBrowser;
+    int currentPreset = -1;
+
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VST1BridgeEditor)
 };
\ No newline at end of file
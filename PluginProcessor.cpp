@@ -3,324 +3,1258 @@
 // ==============================================================================
 #include "PluginProcessor.h"
 #include "PluginEditor.h"
+#include "RealtimeAllocationTrap.h"
+#include "InterleaveKernels.h"
 
+VST1BRIDGE_DEFINE_MODULE_ALLOCATION_TRAP()
+
+namespace
+{
+    // Upper bound for one block round trip before the output is muted
+    constexpr int blockTimeoutMs = 200;
+    // Some legacy plugins spend several seconds in effOpen
+    constexpr int loadTimeoutMs = 30000;
+    // effGetChunk/effSetChunk on big sample-based plugins
+    constexpr int stateTimeoutMs = 10000;
+    // First guess for a state region; the bridge answers the real size if it doesn't fit
+    constexpr size_t initialStateCapacity = 64 * 1024;
+    // Even with an idle generation the state is re-checked this often, for plugins that
+    // change it in ways the bridge can't see
+    constexpr uint32_t stateVerifyIntervalMs = 5 * 60 * 1000;
+}
+
+//==============================================================================
+class VST1BridgeProcessor::PluginLoadJob : public juce::ThreadPoolJob
+{
+public:
+    PluginLoadJob(VST1BridgeProcessor& processor, const juce::File& file, uint32_t loadSequence,
+        std::function<void(LoadState)> callback)
+        : juce::ThreadPoolJob("VST1Bridge plugin load"),
+          owner(processor), dllFile(file), sequence(loadSequence), onComplete(std::move(callback))
+    {
+    }
+
+    bool isFor(const VST1BridgeProcessor* processor) const noexcept { return &owner == processor; }
+
+    JobStatus runJob() override
+    {
+        const auto result = owner.loadPlugin(dllFile, sequence, [this] { return shouldExit(); });
+
+        if (onComplete != nullptr && result != LoadState::Cancelled)
+        {
+            juce::WeakReference<VST1BridgeProcessor> weakOwner(&owner);
+
+            juce::MessageManager::callAsync([weakOwner, callback = std::move(onComplete), result]
+                {
+                    if (weakOwner != nullptr)
+                        callback(result);
+                });
+        }
+
+        return jobHasFinished;
+    }
+
+private:
+    VST1BridgeProcessor& owner;
+    const juce::File dllFile;
+    const uint32_t sequence;
+    std::function<void(LoadState)> onComplete;
+
+    JUCE_DECLARE_NON_COPYABLE(PluginLoadJob)
+};
+
+namespace
+{
+    template <typename JobType, typename Owner>
+    struct JobsOwnedBy : public juce::ThreadPool::JobSelector
+    {
+        explicit JobsOwnedBy(const Owner* o) : owner(o) {}
+
+        bool isJobSuitable(juce::ThreadPoolJob* job) override
+        {
+            auto* typedJob = dynamic_cast<JobType*>(job);
+            return typedJob != nullptr && typedJob->isFor(owner);
+        }
+
+        const Owner* owner;
+    };
+}
+
+//==============================================================================
 VST1BridgeProcessor::VST1BridgeProcessor()
     : AudioProcessor(BusesProperties()
         .withInput("Input", juce::AudioChannelSet::stereo(), true)
         .withOutput("Output", juce::AudioChannelSet::stereo(), true))
 {
-    pipeName = "VST1Bridge_" + juce::String(juce::Time::currentTimeMillis());
-    startBridgeProcess();
+    // No bridge yet: hosts create throwaway instances while scanning, the
+    // process is only started once a plugin is loaded
+
+    for (int i = 0; i < numBridgedParameters; ++i)
+    {
+        auto* parameter = new BridgedParameter(i, pendingParameters);
+        bridgedParameters.add(parameter);
+        addParameter(parameter);
+    }
+
+    mirrorChanges.ensureStorageAllocated(numBridgedParameters);
+
+    // Picks up parameter changes the plugin publishes in the shared mirror
+    startTimerHz(30);
 }
 
 VST1BridgeProcessor::~VST1BridgeProcessor()
 {
+    stopTimer();
+
+    // A running effOpen cannot be interrupted, wait for it to come back. No time limit:
+    // the job refers to this processor until it returns, and it backs out between steps.
+    if (auto* coordinator = RestoreCoordinator::getInstanceWithoutCreating())
+    {
+        JobsOwnedBy<PluginLoadJob, VST1BridgeProcessor> ownJobs(this);
+        coordinator->removeJobs(ownJobs, -1);
+    }
+
     unloadVST1Plugin();
-    stopBridgeProcess();
 }
 
-bool VST1BridgeProcessor::startBridgeProcess()
+void VST1BridgeProcessor::setIsolated(bool shouldBeIsolated)
 {
-    // Get path to Bridge32.exe (should be in same folder as VST3)
-    juce::File exeFile = juce::File::getSpecialLocation(juce::File::currentExecutableFile)
-        .getParentDirectory()
-        .getChildFile("VST1Bridge32.exe");
+    const juce::ScopedLock sl(stateLock);
+
+    // A group of one: nobody else will ever share this bridge process
+    isolated = shouldBeIsolated;
+    isolationGroup = shouldBeIsolated ? "isolated_" + juce::Uuid().toString() : juce::String();
+}
+
+void VST1BridgeProcessor::setPipelinedProcessing(bool shouldPipeline)
+{
+    if (pipelined.exchange(shouldPipeline) == shouldPipeline)
+        return;
+
+    // The region changes shape; same hand-off as prepareToPlay if a load is running
+    preparePending = true;
+
+    const juce::ScopedTryLock sl(bridgeLock);
+
+    if (!sl.isLocked())
+        return;
+
+    preparePending = false;
+    applyPlaybackSettings();
+}
+
+juce::String VST1BridgeProcessor::getLoadedPluginPath() const
+{
+    const juce::ScopedLock sl(stateLock);
+    return loadedPluginPath;
+}
+
+bool VST1BridgeProcessor::connectToBridge(const juce::String& architecture)
+{
+    juce::String group;
 
-    if (!exeFile.existsAsFile())
     {
-        DBG("Bridge32.exe not found at: " + exeFile.getFullPathName());
-        return false;
+        const juce::ScopedLock sl(stateLock);
+        group = isolationGroup;
     }
 
-    // Create named pipes
-    pipeToChild = std::make_unique<juce::NamedPipe>();
-    pipeFromChild = std::make_unique<juce::NamedPipe>();
+    bridge = BridgeProcessRegistry::getInstance()->acquire(architecture, group);
 
-    if (!pipeToChild->createNewPipe(pipeName + "_to", false) ||
-        !pipeFromChild->createNewPipe(pipeName + "_from", false))
+    if (bridge == nullptr)
     {
-        DBG("Failed to create named pipes");
+        DBG("No bridge process available for " + architecture);
         return false;
     }
 
-    // Launch bridge process with pipe names as arguments
-    juce::String commandLine = exeFile.getFullPathName().quoted() + " " +
-        (pipeName + "_to").quoted() + " " +
-        (pipeName + "_from").quoted();
+    instanceId = bridge->allocateInstanceId();
 
-    if (!bridgeProcess.start(commandLine))
+    if (!attachSharedAudio(juce::jmax(getBlockSize(), VST1Bridge::kDefaultSharedAudioSamples)))
     {
-        DBG("Failed to start bridge process");
+        disconnectFromBridge();
         return false;
     }
 
-    // Wait for connection (timeout 5 seconds)
-    int timeout = 50; // 5 seconds
-    while (timeout-- > 0)
+    return true;
+}
+
+void VST1BridgeProcessor::disconnectFromBridge()
+{
+    if (bridge != nullptr)
     {
-        if (pipeToChild->openExisting(pipeName + "_to") &&
-            pipeFromChild->openExisting(pipeName + "_from"))
-        {
-            DBG("Bridge process connected successfully");
-            return true;
-        }
-        juce::Thread::sleep(100);
+        sendRequest(VST1Bridge::MessageType::DestroyInstance);
+        BridgeProcessRegistry::getInstance()->release(bridge);
     }
 
-    DBG("Bridge process connection timeout");
-    stopBridgeProcess();
-    return false;
+    const juce::ScopedLock audioSl(audioLock);
+    blockReady.close();
+    blockDone.close();
+    sharedAudio.close();
+    instanceId = 0;
 }
 
-void VST1BridgeProcessor::stopBridgeProcess()
+bool VST1BridgeProcessor::attachSharedAudio(int maxSamples)
 {
-    if (bridgeProcess.isRunning())
+    const juce::ScopedLock audioSl(audioLock);
+
+    // A fresh name per attach so the bridge never maps a stale, smaller region
+    VST1Bridge::AttachAudioBufferMessage attachMsg;
+    juce::String regionName = bridge->getName() + "_" + juce::String((int)instanceId)
+        + "_audio" + juce::String(++sharedAudioGeneration);
+    regionName.copyToUTF8(attachMsg.regionName, sizeof(attachMsg.regionName));
+    attachMsg.maxChannels = juce::jmax(1, getTotalNumInputChannels(), getTotalNumOutputChannels());
+    attachMsg.maxSamples = maxSamples;
+    attachMsg.spinIterations = doorbellSpinIterations;
+    attachMsg.numSlots = pipelined ? VST1Bridge::kMaxPipelineSlots : 1;
+    attachMsg.sampleSize = isUsingDoublePrecision() ? (int32_t)sizeof(double) : (int32_t)sizeof(float);
+
+    auto regionSize = VST1Bridge::getSharedAudioSize(attachMsg.maxChannels, attachMsg.maxSamples,
+        attachMsg.numSlots, attachMsg.sampleSize);
+
+    blockReady.close();
+    blockDone.close();
+
+    if (!sharedAudio.create(regionName, regionSize))
     {
-        VST1Bridge::MessageHeader header;
-        header.type = VST1Bridge::MessageType::Shutdown;
-        header.dataSize = 0;
-        header.sequenceId = messageSequence++;
-        sendMessage(header);
+        DBG("Failed to create shared audio region");
+        return false;
+    }
 
-        juce::Thread::sleep(100);
-        bridgeProcess.kill();
+    auto* audioHeader = static_cast<VST1Bridge::SharedAudioHeader*>(sharedAudio.getData());
+    audioHeader->magic = VST1Bridge::kSharedAudioMagic;
+    audioHeader->maxChannels = (uint32_t)attachMsg.maxChannels;
+    audioHeader->maxSamples = (uint32_t)attachMsg.maxSamples;
+    audioHeader->numSlots = (uint32_t)attachMsg.numSlots;
+    audioHeader->sampleSize = (uint32_t)attachMsg.sampleSize;
+
+    for (auto& slot : audioHeader->slots)
+        slot.blockSucceeded = 0;
+
+    audioHeader->pluginLatencySamples = pluginLatencySamples.load();
+    audioHeader->pluginTailSamples = pluginTailSamples.load();
+    audioHeader->stateGeneration = 0;
+
+    {
+        // A new region starts its own count
+        const juce::ScopedLock sl(stateLock);
+        pluginStateGenerationValid = false;
     }
 
-    pipeToChild.reset();
-    pipeFromChild.reset();
-}
+    audioHeader->parameterQueue.reset();
+    audioHeader->parameterMirror.reset();
+    lastMirrorSequence = 0;
 
-bool VST1BridgeProcessor::sendMessage(const VST1Bridge::MessageHeader& header, const void* data)
-{
-    if (!pipeToChild || !pipeToChild->isOpen())
+    if (!blockReady.create(audioHeader->blockReady, regionName + "_ready") ||
+        !blockDone.create(audioHeader->blockDone, regionName + "_done"))
+    {
+        DBG("Failed to create block doorbells");
+        sharedAudio.close();
         return false;
+    }
 
-    juce::ScopedLock lock(processLock);
+    blockReady.setSpinIterations(doorbellSpinIterations);
+    blockDone.setSpinIterations(doorbellSpinIterations);
+    blocksSubmitted = 0;
 
-    // Send header
-    if (pipeToChild->write(&header, sizeof(header), 1000) != sizeof(header))
-        return false;
+    // The delay line is one host block long
+    const bool usesDouble = attachMsg.sampleSize == (int32_t)sizeof(double);
+    pipelineLatencySamples = attachMsg.numSlots > 1 ? getBlockSize() : 0;
+    floatPipeline.setSize(usesDouble ? 0 : attachMsg.maxChannels, pipelineLatencySamples);
+    doublePipeline.setSize(usesDouble ? attachMsg.maxChannels : 0, pipelineLatencySamples);
+    pipelineFifo.setTotalSize(2 * pipelineLatencySamples + 1);
+    resetPipeline();
+    updateLatency();
 
-    // Send data if present
-    if (data && header.dataSize > 0)
+    if (!sendRequest(VST1Bridge::MessageType::AttachAudioBuffer, &attachMsg, sizeof(attachMsg)))
     {
-        if (pipeToChild->write(data, header.dataSize, 1000) != (int)header.dataSize)
-            return false;
+        DBG("Bridge failed to attach shared audio region");
+        blockReady.close();
+        blockDone.close();
+        sharedAudio.close();
+        return false;
     }
 
     return true;
 }
 
-bool VST1BridgeProcessor::receiveResponse(VST1Bridge::ResponseMessage& response)
+bool VST1BridgeProcessor::sharedAudioMatchesSettings() const
 {
-    if (!pipeFromChild || !pipeFromChild->isOpen())
-        return false;
+    auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+    const int numSlots = pipelined ? VST1Bridge::kMaxPipelineSlots : 1;
 
-    VST1Bridge::MessageHeader header;
-    if (pipeFromChild->read(&header, sizeof(header), 2000) != sizeof(header))
-        return false;
+    return audio.canHold(juce::jmax(getTotalNumInputChannels(), getTotalNumOutputChannels()), getBlockSize())
+        && audio.getNumSlots() == numSlots
+        && audio.holds<double>() == isUsingDoublePrecision()
+        && (numSlots == 1 || pipelineLatencySamples == getBlockSize());
+}
 
-    if (header.type != VST1Bridge::MessageType::Response)
-        return false;
+void VST1BridgeProcessor::resetPipeline()
+{
+    // The delay line starts out holding one block of silence
+    pipelineFifo.reset();
+    floatPipeline.output.clear();
+    doublePipeline.output.clear();
+    pipelineFifo.finishedWrite(pipelineLatencySamples);
+    pipelinePrimed = false;
+}
+
+void VST1BridgeProcessor::updateLatency()
+{
+    // The host compensates for the plugin's own delay and the bridge's on top of it
+    setLatencySamples(pipelineLatencySamples + pluginLatencySamples);
+}
+
+void VST1BridgeProcessor::readPluginDelays(const VST1Bridge::SharedAudioView& audio)
+{
+    if (!audio.isValid())
+        return;
+
+    setPluginDelays(audio.header->pluginLatencySamples.load(std::memory_order_acquire),
+        audio.header->pluginTailSamples.load(std::memory_order_acquire));
+}
 
-    if (pipeFromChild->read(&response, sizeof(response), 2000) != sizeof(response))
+void VST1BridgeProcessor::setPluginDelays(int latency, int tail)
+{
+    pluginTailSamples = juce::jmax(0, tail);
+    latency = juce::jmax(0, latency);
+
+    if (pluginLatencySamples.exchange(latency) != latency)
+        updateLatency();
+}
+
+double VST1BridgeProcessor::getTailLengthSeconds() const
+{
+    const auto sampleRate = getSampleRate();
+    return sampleRate > 0 ? pluginTailSamples / sampleRate : 0.0;
+}
+
+bool VST1BridgeProcessor::sendRequest(VST1Bridge::MessageType type, const void* data, uint32_t dataSize,
+    VST1Bridge::ResponseMessage& response, int timeoutMs)
+{
+    if (bridge == nullptr)
         return false;
 
-    return true;
+    return bridge->transact(instanceId, type, data, dataSize, response, timeoutMs);
+}
+
+bool VST1BridgeProcessor::sendRequest(VST1Bridge::MessageType type, const void* data, uint32_t dataSize)
+{
+    VST1Bridge::ResponseMessage response;
+    return sendRequest(type, data, dataSize, response) && response.success;
 }
 
 bool VST1BridgeProcessor::loadVST1Plugin(const juce::File& dllFile)
 {
-    if (!dllFile.existsAsFile())
-        return false;
+    const auto sequence = beginPluginLoad(dllFile);
+    return loadPlugin(dllFile, sequence, [] { return false; }) == LoadState::Loaded;
+}
 
-    unloadVST1Plugin();
+void VST1BridgeProcessor::loadVST1PluginAsync(const juce::File& dllFile, std::function<void(LoadState)> onComplete)
+{
+    const auto sequence = beginPluginLoad(dllFile);
 
-    VST1Bridge::LoadPluginMessage loadMsg;
-    dllFile.getFullPathName().copyToUTF8(loadMsg.dllPath, sizeof(loadMsg.dllPath));
+    // Instances restored together load in parallel on the shared pool
+    RestoreCoordinator::getInstance()->addJob(new PluginLoadJob(*this, dllFile, sequence, std::move(onComplete)));
+}
 
-    VST1Bridge::MessageHeader header;
-    header.type = VST1Bridge::MessageType::LoadPlugin;
-    header.dataSize = sizeof(loadMsg);
-    header.sequenceId = messageSequence++;
+// Supersedes any load in flight and returns the number of the new one
+uint32_t VST1BridgeProcessor::beginPluginLoad(const juce::File& dllFile)
+{
+    cancelPluginLoad();
 
-    if (!sendMessage(header, &loadMsg))
-        return false;
+    const juce::ScopedLock sl(stateLock);
+    pendingPluginPath = dllFile.getFullPathName();
+    loadState = LoadState::StartingBridge;
+    return ++loadSequence;
+}
+
+void VST1BridgeProcessor::cancelPluginLoad()
+{
+    {
+        // A load that is still running finishes on its own, but no longer reports
+        const juce::ScopedLock sl(stateLock);
+        ++loadSequence;
+        pendingPluginPath.clear();
+
+        if (loadState == LoadState::StartingBridge || loadState == LoadState::LoadingPlugin)
+            loadState = LoadState::Cancelled;
+    }
+
+    // Drops queued loads and asks a running one to back out at its next step
+    if (auto* coordinator = RestoreCoordinator::getInstanceWithoutCreating())
+    {
+        JobsOwnedBy<PluginLoadJob, VST1BridgeProcessor> ownJobs(this);
+        coordinator->removeJobs(ownJobs, 0);
+    }
+}
+
+void VST1BridgeProcessor::setLoadState(uint32_t sequence, LoadState state)
+{
+    const juce::ScopedLock sl(stateLock);
+
+    if (sequence == loadSequence)
+        loadState = state;
+}
+
+VST1BridgeProcessor::LoadState VST1BridgeProcessor::loadPlugin(const juce::File& dllFile, uint32_t sequence,
+    const std::function<bool()>& shouldCancel)
+{
+    // Cancelled, or superseded by a newer load
+    auto isCancelled = [&] { return shouldCancel() || sequence != loadSequence; };
+
+    const auto result = [&]
+    {
+        if (!dllFile.existsAsFile())
+            return LoadState::Failed;
+
+        const juce::ScopedLock sl(bridgeLock);
+
+        unloadPluginInBridge();
+
+        if (isCancelled())
+            return LoadState::Cancelled;
+
+        // 32-bit and 64-bit plugins need different bridge executables
+        auto architecture = BridgeProcess::getArchitectureOf(dllFile);
+        juce::String group;
+
+        {
+            const juce::ScopedLock stateSl(stateLock);
+            group = isolationGroup;
+        }
+
+        if (bridge == nullptr || !bridge->isRunning()
+            || bridge->getArchitecture() != architecture
+            || bridge->getIsolationGroup() != group)
+        {
+            setLoadState(sequence, LoadState::StartingBridge);
+            disconnectFromBridge();
+
+            if (!connectToBridge(architecture))
+                return LoadState::Failed;
+        }
+
+        if (isCancelled())
+        {
+            disconnectFromBridge();
+            return LoadState::Cancelled;
+        }
+
+        setLoadState(sequence, LoadState::LoadingPlugin);
+
+        if (!loadPluginInBridge(dllFile))
+        {
+            // Don't keep a bridge alive for an instance that stays empty
+            disconnectFromBridge();
+            return LoadState::Failed;
+        }
+
+        // effOpen can't be interrupted, so undo it if the result is no longer wanted
+        if (isCancelled())
+        {
+            unloadPluginInBridge();
+            disconnectFromBridge();
+            return LoadState::Cancelled;
+        }
+
+        return LoadState::Loaded;
+    }();
+
+    {
+        const juce::ScopedLock sl(stateLock);
+
+        // The state and path belong to whatever load or cancel came after this one
+        if (sequence != loadSequence)
+            return LoadState::Cancelled;
+
+        pendingPluginPath.clear();
+        loadState = result;
+    }
+
+    // prepareToPlay found the load running and left its settings to us
+    if (result == LoadState::Loaded && preparePending.exchange(false))
+    {
+        const juce::ScopedLock sl(bridgeLock);
+        applyPlaybackSettings();
+    }
+
+    return result;
+}
+
+bool VST1BridgeProcessor::loadPluginInBridge(const juce::File& dllFile)
+{
+    VST1Bridge::LoadPluginMessage loadMsg;
+    dllFile.getFullPathName().copyToUTF8(loadMsg.dllPath, sizeof(loadMsg.dllPath));
+    loadMsg.preferredLayout = VST1Bridge::AudioLayout::Planar;
 
     VST1Bridge::ResponseMessage response;
-    if (!receiveResponse(response) || !response.success)
+    if (!sendRequest(VST1Bridge::MessageType::LoadPlugin, &loadMsg, sizeof(loadMsg), response, loadTimeoutMs)
+        || !response.success)
         return false;
 
-    pluginLoaded = true;
-    loadedPluginPath = dllFile.getFullPathName();
+    audioLayout = response.intValue == (int32_t)VST1Bridge::AudioLayout::Planar
+        ? VST1Bridge::AudioLayout::Planar
+        : VST1Bridge::AudioLayout::Interleaved;
+    loadedPluginUniqueID = response.pluginUniqueID;
+
+    juce::MemoryBlock restoredState;
 
-    // Send current sample rate and block size
-    if (getSampleRate() > 0)
     {
-        VST1Bridge::SetSampleRateMessage srMsg;
-        srMsg.sampleRate = getSampleRate();
-        header.type = VST1Bridge::MessageType::SetSampleRate;
-        header.dataSize = sizeof(srMsg);
-        header.sequenceId = messageSequence++;
-        sendMessage(header, &srMsg);
-        receiveResponse(response);
+        const juce::ScopedLock sl(stateLock);
+        loadedPluginPath = dllFile.getFullPathName();
+
+        // A session's state only fits the plugin it was saved from
+        if (pluginStatePath != loadedPluginPath)
+        {
+            pluginState.reset();
+            encodedPluginState.reset();
+            pluginStatePath = loadedPluginPath;
+        }
+        else if (pluginStatePending)
+        {
+            restoredState = pluginState;
+        }
+
+        pluginStatePending = false;
+        pluginStateGenerationValid = false;
     }
 
+    if (!restoredState.isEmpty() && !applyPluginState(restoredState))
+        DBG("Bridge failed to restore the plugin's state");
+
+    refreshParameterInfo();
+
+    // The bridge may have been started after prepareToPlay, catch it up. The
+    // audio path stays muted until the plugin has been resumed.
+    applyPlaybackSettings();
+
+    if (getSampleRate() > 0)
+        sendPlaybackSettings();
+
+    // Report the plugin's latency before the host starts playing through it
+    readPluginDelays(VST1Bridge::SharedAudioView::fromRegion(sharedAudio));
+
+    pluginLoaded = true;
     return true;
 }
 
 void VST1BridgeProcessor::unloadVST1Plugin()
+{
+    cancelPluginLoad();
+
+    const juce::ScopedLock sl(bridgeLock);
+    unloadPluginInBridge();
+    disconnectFromBridge();
+    loadState = LoadState::Idle;
+}
+
+void VST1BridgeProcessor::unloadPluginInBridge()
 {
     if (!pluginLoaded)
         return;
 
-    VST1Bridge::MessageHeader header;
-    header.type = VST1Bridge::MessageType::UnloadPlugin;
-    header.dataSize = 0;
-    header.sequenceId = messageSequence++;
+    pluginLoaded = false;
+    loadedPluginUniqueID = 0;
+    sendRequest(VST1Bridge::MessageType::UnloadPlugin);
 
-    sendMessage(header);
+    for (auto* parameter : bridgedParameters)
+        parameter->clearPluginInfo();
 
-    VST1Bridge::ResponseMessage response;
-    receiveResponse(response);
+    pluginLatencySamples = 0;
+    pluginTailSamples = 0;
+    updateLatency();
+    updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withParameterInfoChanged(true));
 
-    pluginLoaded = false;
+    const juce::ScopedLock sl(stateLock);
     loadedPluginPath.clear();
 }
 
-void VST1BridgeProcessor::prepareToPlay(double sampleRate, int samplesPerBlock)
+void VST1BridgeProcessor::applyPlaybackSettings()
 {
-    if (!pluginLoaded)
-        return;
+    // Bigger blocks, or pipelining switched on or off, need a region of another shape
+    if (bridge != nullptr && !sharedAudioMatchesSettings())
+        attachSharedAudio(juce::jmax(getBlockSize(), VST1Bridge::kDefaultSharedAudioSamples));
+
+    if (pluginLoaded && getSampleRate() > 0)
+        sendPlaybackSettings();
+}
 
+void VST1BridgeProcessor::sendPlaybackSettings()
+{
     VST1Bridge::SetSampleRateMessage srMsg;
-    srMsg.sampleRate = sampleRate;
+    srMsg.sampleRate = getSampleRate();
+
+    VST1Bridge::SetBlockSizeMessage bsMsg;
+    bsMsg.blockSize = getBlockSize();
+
+    VST1Bridge::IOConfigurationMessage ioMsg;
+    ioMsg.numInputs = getTotalNumInputChannels();
+    ioMsg.numOutputs = getTotalNumOutputChannels();
+    ioMsg.nonRealtime = isNonRealtime() ? 1 : 0;
+
+    // One round trip for the lot; the plugin needs rate and block size before resuming
+    CommandBatch batch;
+    batch.add(VST1Bridge::MessageType::Suspend);
+    batch.add(VST1Bridge::MessageType::SetSampleRate, srMsg);
+    batch.add(VST1Bridge::MessageType::SetBlockSize, bsMsg);
+    batch.add(VST1Bridge::MessageType::SetIOConfiguration, ioMsg);
+    batch.add(VST1Bridge::MessageType::Resume);
+
+    sendBatch(batch);
+}
+
+bool VST1BridgeProcessor::sendBatch(const CommandBatch& batch)
+{
+    VST1Bridge::ResponseMessage response;
 
-    VST1Bridge::MessageHeader header;
-    header.type = VST1Bridge::MessageType::SetSampleRate;
-    header.dataSize = sizeof(srMsg);
-    header.sequenceId = messageSequence++;
+    if (!sendRequest(VST1Bridge::MessageType::Batch, batch.getData(), batch.getDataSize(), response))
+        return false;
+
+    for (int i = 0; i < batch.size(); ++i)
+        if (!CommandBatch::succeeded(response.intValue, i))
+            DBG("Bridge batch command " + juce::String(i) + " failed");
 
-    sendMessage(header, &srMsg);
+    return response.success;
+}
 
+void VST1BridgeProcessor::refreshParameterInfo()
+{
     VST1Bridge::ResponseMessage response;
-    receiveResponse(response);
+    int numPluginParameters = 0;
 
-    VST1Bridge::SetBlockSizeMessage bsMsg;
-    bsMsg.blockSize = samplesPerBlock;
+    if (sendRequest(VST1Bridge::MessageType::GetParameterCount, nullptr, 0, response) && response.success)
+    {
+        numPluginParameters = juce::jmin((int)response.intValue, numBridgedParameters);
+
+        if (response.intValue > numBridgedParameters)
+            DBG("Plugin has " + juce::String(response.intValue) + " parameters, only the first "
+                + juce::String(numBridgedParameters) + " can be automated");
+    }
+
+    // Every name, label and value in one transfer rather than a round trip each
+    VST1Bridge::StateTransferMessage msg {};
+    juce::MemoryBlock table;
 
-    header.type = VST1Bridge::MessageType::SetBlockSize;
-    header.dataSize = sizeof(bsMsg);
-    header.sequenceId = messageSequence++;
+    if (numPluginParameters <= 0 || !receiveFromBridge(VST1Bridge::MessageType::GetParameterInfo, msg, table))
+        table.reset();
 
-    sendMessage(header, &bsMsg);
-    receiveResponse(response);
+    const auto* entries = static_cast<const VST1Bridge::ParameterInfoEntry*>(table.getData());
+    const int numEntries = juce::jmin(numPluginParameters, (int)(table.getSize() / sizeof(VST1Bridge::ParameterInfoEntry)));
+
+    for (int i = 0; i < numBridgedParameters; ++i)
+    {
+        auto* parameter = bridgedParameters.getUnchecked(i);
 
-    // Resume processing
-    header.type = VST1Bridge::MessageType::Resume;
-    header.dataSize = 0;
-    header.sequenceId = messageSequence++;
-    sendMessage(header);
-    receiveResponse(response);
+        if (i < numEntries)
+        {
+            auto entry = entries[i];
+            entry.name[sizeof(entry.name) - 1] = '\0';
+            entry.label[sizeof(entry.label) - 1] = '\0';
+            parameter->setPluginInfo(juce::String::fromUTF8(entry.name).trim(),
+                juce::String::fromUTF8(entry.label).trim(), entry.value);
+        }
+        else
+        {
+            parameter->clearPluginInfo();
+        }
+    }
+
+    updateHostDisplay(juce::AudioProcessorListener::ChangeDetails().withParameterInfoChanged(true));
 }
 
-void VST1BridgeProcessor::releaseResources()
+void VST1BridgeProcessor::timerCallback()
 {
-    if (!pluginLoaded)
-        return;
+    int32_t latency = 0, tail = 0;
+    mirrorChanges.clearQuick();
 
-    VST1Bridge::MessageHeader header;
-    header.type = VST1Bridge::MessageType::Suspend;
-    header.dataSize = 0;
-    header.sequenceId = messageSequence++;
+    {
+        // Skip a tick rather than wait for a load or remap. Only copies out under the lock:
+        // processBlock drops any block that finds it taken, and listeners and
+        // setLatencySamples run host code that may take a while.
+        const juce::ScopedTryLock sl(audioLock);
 
-    sendMessage(header);
+        if (!sl.isLocked() || !pluginLoaded)
+            return;
 
-    VST1Bridge::ResponseMessage response;
-    receiveResponse(response);
+        auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+
+        if (!audio.isValid())
+            return;
+
+        // The plugin may change its latency at any time through audioMasterIOChanged
+        latency = audio.header->pluginLatencySamples.load(std::memory_order_acquire);
+        tail = audio.header->pluginTailSamples.load(std::memory_order_acquire);
+
+        auto& mirror = audio.header->parameterMirror;
+        const auto sequence = mirror.sequence.load(std::memory_order_acquire);
+
+        if (sequence != lastMirrorSequence)
+        {
+            lastMirrorSequence = sequence;
+
+            mirror.collectDirty([this](int32_t index, float value)
+                {
+                    mirrorChanges.add({ index, value });
+                });
+        }
+    }
+
+    setPluginDelays(latency, tail);
+
+    for (const auto& change : mirrorChanges)
+        if (change.index < bridgedParameters.size())
+            bridgedParameters.getUnchecked(change.index)->updateFromPlugin(change.value);
+}
+
+void VST1BridgeProcessor::queueParameterChanges(VST1Bridge::SharedParameterQueue& queue)
+{
+    pendingParameters.take([this, &queue](int index)
+        {
+            if (index >= bridgedParameters.size())
+                return;
+
+            // Full queue: leave it for the next block
+            if (!queue.push({ index, bridgedParameters.getUnchecked(index)->getValue() }))
+                pendingParameters.mark(index);
+        });
 }
 
-void VST1BridgeProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& /*midiMessages*/)
+void VST1BridgeProcessor::prepareToPlay(double /*sampleRate*/, int /*samplesPerBlock*/)
+{
+    // The host has already stored the new rate and block size, which is what
+    // applyPlaybackSettings sends. Set the flag first so a load that holds the
+    // lock right now is guaranteed to see it once it finishes.
+    preparePending = true;
+
+    const juce::ScopedTryLock sl(bridgeLock);
+
+    if (!sl.isLocked())
+        return;
+
+    preparePending = false;
+    applyPlaybackSettings();
+}
 
+void VST1BridgeProcessor::releaseResources()
 {
-    juce::ScopedNoDenormals noDenormals;
+    preparePending = false;
 
-    if (!pluginLoaded || !pipeToChild || !pipeFromChild)
-    {
-        buffer.clear();
+    // A load in progress is not resumed unless prepareToPlay comes in again
+    const juce::ScopedTryLock sl(bridgeLock);
+
+    if (!sl.isLocked() || !pluginLoaded)
         return;
-    }
+
+    sendRequest(VST1Bridge::MessageType::Suspend);
+}
+
+void VST1BridgeProcessor::processBlock(juce::AudioBuffer<float>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processSamples(buffer, midiMessages);
+}
+
+void VST1BridgeProcessor::processBlock(juce::AudioBuffer<double>& buffer, juce::MidiBuffer& midiMessages)
+{
+    processSamples(buffer, midiMessages);
+}
+
+template <typename SampleType>
+void VST1BridgeProcessor::processSamples(juce::AudioBuffer<SampleType>& buffer, juce::MidiBuffer& midiMessages)
+{
+    juce::ScopedNoDenormals noDenormals;
+    const VST1Bridge::ScopedRealtimeSection realtimeSection;
 
     int numSamples = buffer.getNumSamples();
     int numInputs = getTotalNumInputChannels();
     int numOutputs = getTotalNumOutputChannels();
 
-    // Prepare message
-    VST1Bridge::ProcessAudioMessage procMsg;
-    procMsg.numSamples = numSamples;
-    procMsg.numInputs = numInputs;
-    procMsg.numOutputs = numOutputs;
+    // Loads and block size changes remap the region under this lock
+    const juce::ScopedTryLock audioTryLock(audioLock);
 
-    VST1Bridge::MessageHeader header;
-    header.type = VST1Bridge::MessageType::ProcessAudio;
-    header.dataSize = sizeof(procMsg) + (numSamples * numInputs * sizeof(float));
-    header.sequenceId = messageSequence++;
+    auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
 
-    // Send header and message
-    if (!sendMessage(header, &procMsg))
+    // The region is reshaped for the new precision in prepareToPlay
+    if (!audioTryLock.isLocked() || !pluginLoaded || !blockDone.isOpen() || !audio.holds<SampleType>()
+        || !audio.canHold(juce::jmax(numInputs, numOutputs), numSamples))
     {
         buffer.clear();
         return;
     }
 
-    // Send audio data (interleaved)
-    juce::HeapBlock<float> interleavedData;
-    interleavedData.allocate(numSamples * numInputs, true);
+    if (audio.getNumSlots() > 1)
+    {
+        processPipelined(audio, buffer, midiMessages, numInputs, numOutputs);
+        return;
+    }
 
-    for (int ch = 0; ch < numInputs; ++ch)
+    // A block that timed out earlier may still be running in the bridge
+    if (blockDone.current() != blocksSubmitted)
     {
-        const float* channelData = buffer.getReadPointer(ch);
-        for (int i = 0; i < numSamples; ++i)
-            interleavedData[i * numInputs + ch] = channelData[i];
+        buffer.clear();
+        return;
     }
 
-    if (pipeToChild->write(interleavedData, numSamples * numInputs * sizeof(float), 1000) !=
-        numSamples * numInputs * (int)sizeof(float))
+    const int slot = submitBlock(audio, buffer, midiMessages, numInputs, numOutputs);
+
+    // Wait for the bridge's audio thread to ring back
+    if (!waitForBlocksDone(blocksSubmitted) || !audio.header->slots[slot].blockSucceeded)
     {
         buffer.clear();
         return;
     }
 
-    // Receive processed audio
-    VST1Bridge::ResponseMessage response;
-    if (!receiveResponse(response) || !response.success)
+    readBlockOutput(audio, slot, buffer.getArrayOfWritePointers(), numOutputs, numSamples);
+}
+
+template <typename SampleType>
+void VST1BridgeProcessor::processPipelined(const VST1Bridge::SharedAudioView& audio, juce::AudioBuffer<SampleType>& buffer,
+    const juce::MidiBuffer& midiMessages, int numInputs, int numOutputs)
+{
+    const int numSamples = buffer.getNumSamples();
+    auto& pipelineOutput = getPipelineBuffers<SampleType>().output;
+    auto& pipelineScratch = getPipelineBuffers<SampleType>().scratch;
+
+    // The delay line can't cover a block longer than itself
+    if (numSamples > pipelineLatencySamples)
     {
+        resetPipeline();
         buffer.clear();
         return;
     }
 
-    // Read audio data back
-    if (pipeFromChild->read(interleavedData, numSamples * numOutputs * sizeof(float), 2000) !=
-        numSamples * numOutputs * (int)sizeof(float))
+    // After a reset, start over only once the bridge has caught up
+    if (!pipelinePrimed && blockDone.current() != blocksSubmitted)
     {
         buffer.clear();
         return;
     }
 
-    // Deinterleave back to buffer
+    submitBlock(audio, buffer, midiMessages, numInputs, numOutputs);
+
+    if (pipelinePrimed)
+    {
+        // Only the previous block has to be done; this one runs while the host carries on
+        if (!waitForBlocksDone(blocksSubmitted - 1))
+        {
+            resetPipeline();
+            buffer.clear();
+            return;
+        }
+
+        const int previousSlot = (int)((blocksSubmitted - 2) % (uint32_t)audio.getNumSlots());
+        const auto& previous = audio.header->slots[previousSlot];
+        const int previousSamples = previous.block.numSamples;
+
+        if (previous.blockSucceeded)
+            readBlockOutput(audio, previousSlot, pipelineScratch.getArrayOfWritePointers(), numOutputs, previousSamples);
+        else
+            pipelineScratch.clear();
+
+        int start1, size1, start2, size2;
+        pipelineFifo.prepareToWrite(previousSamples, start1, size1, start2, size2);
+
+        for (int ch = 0; ch < numOutputs; ++ch)
+        {
+            juce::FloatVectorOperations::copy(pipelineOutput.getWritePointer(ch) + start1, pipelineScratch.getReadPointer(ch), size1);
+            juce::FloatVectorOperations::copy(pipelineOutput.getWritePointer(ch) + start2, pipelineScratch.getReadPointer(ch) + size1, size2);
+        }
+
+        pipelineFifo.finishedWrite(size1 + size2);
+    }
+
+    pipelinePrimed = true;
+
+    // Play the oldest samples in the delay line
+    int start1, size1, start2, size2;
+    pipelineFifo.prepareToRead(numSamples, start1, size1, start2, size2);
+
     for (int ch = 0; ch < numOutputs; ++ch)
     {
-        float* channelData = buffer.getWritePointer(ch);
-        for (int i = 0; i < numSamples; ++i)
-            channelData[i] = interleavedData[i * numOutputs + ch];
+        juce::FloatVectorOperations::copy(buffer.getWritePointer(ch), pipelineOutput.getReadPointer(ch) + start1, size1);
+        juce::FloatVectorOperations::copy(buffer.getWritePointer(ch) + size1, pipelineOutput.getReadPointer(ch) + start2, size2);
+    }
+
+    pipelineFifo.finishedRead(size1 + size2);
+}
+
+template <typename SampleType>
+int VST1BridgeProcessor::submitBlock(const VST1Bridge::SharedAudioView& audio, const juce::AudioBuffer<SampleType>& buffer,
+    const juce::MidiBuffer& midiMessages, int numInputs, int numOutputs)
+{
+    const int numSamples = buffer.getNumSamples();
+    const int slotIndex = (int)(blocksSubmitted % (uint32_t)audio.getNumSlots());
+    auto& slot = audio.header->slots[slotIndex];
+
+    // Write input in place into the shared audio region
+    if (audioLayout == VST1Bridge::AudioLayout::Planar)
+    {
+        for (int ch = 0; ch < numInputs; ++ch)
+            juce::FloatVectorOperations::copy(audio.getInputChannel<SampleType>(slotIndex, ch), buffer.getReadPointer(ch), numSamples);
+    }
+    else
+    {
+        VST1Bridge::Interleave::interleave(buffer.getArrayOfReadPointers(), audio.getInputs<SampleType>(slotIndex), numInputs, numSamples);
+    }
+
+    // MIDI rides along in the same block, with its sample offsets
+    int numMidiEvents = 0;
+
+    for (const auto metadata : midiMessages)
+    {
+        if (numMidiEvents >= VST1Bridge::kMaxMidiEventsPerBlock)
+            break;
+
+        if (metadata.numBytes > 3)
+            continue;
+
+        auto& event = slot.midiEvents[numMidiEvents++];
+        event.deltaFrames = juce::jlimit(0, juce::jmax(0, numSamples - 1), metadata.samplePosition);
+        std::memset(event.data, 0, sizeof(event.data));
+        std::memcpy(event.data, metadata.data, (size_t)metadata.numBytes);
+    }
+
+    // Automation since the last block goes with it and is applied before processing
+    queueParameterChanges(audio.header->parameterQueue);
+
+    // So is the transport, for tempo-synced plugins
+    captureTimeInfo(slot.timeInfo);
+
+    // Hand the block over to the bridge's audio thread
+    slot.block.numMidiEvents = numMidiEvents;
+    slot.block.parameterQueueEnd = audio.header->parameterQueue.writePosition.load(std::memory_order_relaxed);
+    slot.block.numSamples = numSamples;
+    slot.block.numInputs = numInputs;
+    slot.block.numOutputs = numOutputs;
+    slot.block.layout = audioLayout;
+
+    blockReady.ring();
+    ++blocksSubmitted;
+    return slotIndex;
+}
+
+template <typename SampleType>
+void VST1BridgeProcessor::readBlockOutput(const VST1Bridge::SharedAudioView& audio, int slot, SampleType* const* dest,
+    int numOutputs, int numSamples) const
+{
+    // Copy back the output the bridge wrote in place
+    if (audioLayout == VST1Bridge::AudioLayout::Planar)
+    {
+        for (int ch = 0; ch < numOutputs; ++ch)
+            juce::FloatVectorOperations::copy(dest[ch], audio.getOutputChannel<SampleType>(slot, ch), numSamples);
+    }
+    else
+    {
+        VST1Bridge::Interleave::deinterleave(audio.getOutputs<SampleType>(slot), dest, numOutputs, numSamples);
+    }
+}
+
+void VST1BridgeProcessor::captureTimeInfo(VST1Bridge::SharedTimeInfo& info)
+{
+    info = {};
+    info.sampleRate = getSampleRate();
+
+    auto* playHead = getPlayHead();
+
+    if (playHead == nullptr)
+        return;
+
+    const auto position = playHead->getPosition();
+
+    if (!position.hasValue())
+        return;
+
+    uint32_t flags = 0;
+
+    if (position->getIsPlaying())
+        flags |= VST1Bridge::kTimeInfoPlaying;
+
+    if (position->getIsRecording())
+        flags |= VST1Bridge::kTimeInfoRecording;
+
+    if (position->getIsLooping())
+        flags |= VST1Bridge::kTimeInfoLooping;
+
+    if (const auto samples = position->getTimeInSamples())
+        info.samplePosition = (double)*samples;
+
+    if (const auto ppq = position->getPpqPosition())
+    {
+        info.ppqPosition = *ppq;
+        flags |= VST1Bridge::kTimeInfoPpqValid;
+    }
+
+    if (const auto bpm = position->getBpm())
+    {
+        info.tempo = *bpm;
+        flags |= VST1Bridge::kTimeInfoTempoValid;
+    }
+
+    if (const auto barStart = position->getPpqPositionOfLastBarStart())
+    {
+        info.barStartPpq = *barStart;
+        flags |= VST1Bridge::kTimeInfoBarValid;
+    }
+
+    if (const auto loop = position->getLoopPoints())
+    {
+        info.loopStartPpq = loop->ppqStart;
+        info.loopEndPpq = loop->ppqEnd;
+        flags |= VST1Bridge::kTimeInfoLoopValid;
+    }
+
+    if (const auto timeSignature = position->getTimeSignature())
+    {
+        info.timeSigNumerator = timeSignature->numerator;
+        info.timeSigDenominator = timeSignature->denominator;
+        flags |= VST1Bridge::kTimeInfoTimeSigValid;
+    }
+
+    if (const auto hostTime = position->getHostTimeNs())
+    {
+        info.systemTimeNanos = (double)*hostTime;
+        flags |= VST1Bridge::kTimeInfoSystemTimeValid;
+    }
+
+    info.flags = flags;
+}
+
+bool VST1BridgeProcessor::waitForBlocksDone(uint32_t numBlocks)
+{
+    const auto deadline = juce::Time::getMillisecondCounter() + (uint32_t)blockTimeoutMs;
+
+    for (;;)
+    {
+        const auto done = blockDone.current();
+
+        // done >= numBlocks, allowing for the counter wrapping
+        if ((int32_t)(done - numBlocks) >= 0)
+            return true;
+
+        const auto now = juce::Time::getMillisecondCounter();
+
+        if (now >= deadline)
+            return false;
+
+        blockDone.wait(done, (int)(deadline - now));
+    }
+}
+
+juce::String VST1BridgeProcessor::createStateRegionName()
+{
+    return bridge->getName() + "_" + juce::String((int)instanceId)
+        + "_state" + juce::String(++stateRegionGeneration);
+}
+
+// Leaves dest empty if the bridge answered a size of 0
+bool VST1BridgeProcessor::receiveFromBridge(VST1Bridge::MessageType type, VST1Bridge::StateTransferMessage& msg,
+    juce::MemoryBlock& dest)
+{
+    if (bridge == nullptr)
+        return false;
+
+    auto capacity = juce::jmax(stateCapacityHint, initialStateCapacity);
+
+    // The second attempt uses the size the first one answered
+    for (int attempt = 0; attempt < 2; ++attempt)
+    {
+        VST1Bridge::SharedMemoryRegion region;
+        const auto regionName = createStateRegionName();
+        regionName.copyToUTF8(msg.regionName, sizeof(msg.regionName));
+        msg.size = (int32_t)capacity;
+
+        if (!region.create(regionName, capacity))
+            return false;
+
+        VST1Bridge::ResponseMessage response;
+        if (!sendRequest(type, &msg, sizeof(msg), response, stateTimeoutMs)
+            || !response.success || response.intValue < 0)
+            return false;
+
+        const auto stateSize = (size_t)response.intValue;
+
+        if (stateSize == 0)
+        {
+            dest.reset();
+            return true;
+        }
+
+        if (stateSize <= capacity)
+        {
+            dest.replaceAll(region.getData(), stateSize);
+            stateCapacityHint = stateSize;
+            return true;
+        }
+
+        capacity = stateSize;
     }
+
+    return false;
+}
+
+bool VST1BridgeProcessor::sendToBridge(VST1Bridge::MessageType type, const juce::MemoryBlock& bytes,
+    VST1Bridge::ResponseMessage& response)
+{
+    if (bridge == nullptr || bytes.isEmpty())
+        return false;
+
+    VST1Bridge::StateTransferMessage msg {};
+    VST1Bridge::SharedMemoryRegion region;
+    const auto regionName = createStateRegionName();
+    regionName.copyToUTF8(msg.regionName, sizeof(msg.regionName));
+    msg.size = (int32_t)bytes.getSize();
+
+    if (!region.create(regionName, bytes.getSize()))
+        return false;
+
+    std::memcpy(region.getData(), bytes.getData(), bytes.getSize());
+
+    return sendRequest(type, &msg, sizeof(msg), response, stateTimeoutMs) && response.success;
+}
+
+bool VST1BridgeProcessor::fetchPluginState(juce::MemoryBlock& dest, uint64_t knownHash)
+{
+    VST1Bridge::StateTransferMessage msg {};
+    msg.knownHash = knownHash;
+    return receiveFromBridge(VST1Bridge::MessageType::GetState, msg, dest);
+}
+
+bool VST1BridgeProcessor::applyPluginState(const juce::MemoryBlock& state)
+{
+    VST1Bridge::ResponseMessage response;
+    return sendToBridge(VST1Bridge::MessageType::SetState, state, response);
+}
+
+bool VST1BridgeProcessor::loadPresetFile(const juce::File& presetFile)
+{
+    juce::MemoryBlock file;
+
+    if (!presetFile.loadFileAsData(file))
+        return false;
+
+    // Auditioning must not queue up behind a plugin load
+    const juce::ScopedTryLock sl(bridgeLock);
+
+    if (!sl.isLocked() || !pluginLoaded)
+        return false;
+
+    VST1Bridge::ResponseMessage response {};
+
+    if (!sendToBridge(VST1Bridge::MessageType::LoadPreset, file, response))
+    {
+        DBG("Preset not loaded: " + juce::String::fromUTF8(response.errorMessage));
+        return false;
+    }
+
+    return true;
+}
+
+bool VST1BridgeProcessor::savePresetFile(const juce::File& presetFile, bool asBank)
+{
+    juce::MemoryBlock file;
+
+    {
+        const juce::ScopedTryLock sl(bridgeLock);
+
+        if (!sl.isLocked() || !pluginLoaded)
+            return false;
+
+        VST1Bridge::StateTransferMessage msg {};
+        msg.asBank = asBank ? 1 : 0;
+
+        if (!receiveFromBridge(VST1Bridge::MessageType::SavePreset, msg, file) || file.isEmpty())
+            return false;
+    }
+
+    return presetFile.replaceWithData(file.getData(), file.getSize());
+}
+
+void VST1BridgeProcessor::refreshPluginState()
+{
+    // A load in progress owns the bridge; the state cached before it is still the right one
+    const juce::ScopedTryLock sl(bridgeLock);
+
+    if (!sl.isLocked() || !pluginLoaded)
+        return;
+
+    // Read before the fetch, so a change made while it runs is picked up by the next save
+    auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+    const auto generation = audio.isValid() ? audio.header->stateGeneration.load(std::memory_order_acquire) : 0;
+    const auto now = juce::Time::getMillisecondCounter();
+    uint64_t knownHash = 0;
+
+    {
+        const juce::ScopedLock stateSl(stateLock);
+
+        // A restored state waiting for its plugin must not be replaced by the one still running
+        if (pluginStatePending || pluginStatePath != loadedPluginPath)
+            return;
+
+        // Autosaves of an untouched plugin stop here, without a round trip to the bridge
+        if (audio.isValid() && pluginStateGenerationValid && generation == pluginStateGeneration
+            && now - pluginStateVerifiedMs < stateVerifyIntervalMs)
+            return;
+
+        if (!encodedPluginState.isEmpty())
+            knownHash = pluginStateHash;
+    }
+
+    juce::MemoryBlock state;
+
+    if (!fetchPluginState(state, knownHash))
+        return;
+
+    const juce::ScopedLock stateSl(stateLock);
+
+    if (pluginStatePending || pluginStatePath != loadedPluginPath)
+        return;
+
+    pluginStateGeneration = generation;
+    pluginStateGenerationValid = audio.isValid();
+    pluginStateVerifiedMs = now;
+
+    // Unchanged: the bridge copied nothing and the cached encoding still stands
+    if (state.isEmpty() || state == pluginState)
+        return;
+
+    pluginState = std::move(state);
+    pluginStateHash = VST1Bridge::hashPluginState(pluginState.getData(), pluginState.getSize());
+
+    juce::MemoryOutputStream compressed;
+
+    {
+        juce::GZIPCompressorOutputStream gzip(compressed, 1);
+        gzip.write(pluginState.getData(), pluginState.getSize());
+    }
+
+    pluginStateCompressed = compressed.getDataSize() < pluginState.getSize();
+    encodedPluginState = pluginStateCompressed ? compressed.getMemoryBlock() : pluginState;
 }
 
 void VST1BridgeProcessor::getStateInformation(juce::MemoryBlock& destData)
 {
+    refreshPluginState();
+
     juce::XmlElement xml("VST1BridgeState");
-    xml.setAttribute("pluginPath", loadedPluginPath);
+    const juce::ScopedLock sl(stateLock);
+
+    // A restore still in flight has to survive a save that comes in before it finishes
+    const auto path = loadedPluginPath.isNotEmpty() ? loadedPluginPath : pendingPluginPath;
+    const bool hasState = path.isNotEmpty() && path == pluginStatePath && !encodedPluginState.isEmpty();
+
+    xml.setAttribute("pluginPath", path);
+    xml.setAttribute("isolated", isolated.load());
+    xml.setAttribute("pipelined", pipelined.load());
+
+    // The plugin's state is appended as raw bytes after the XML, stateSize counts them
+    if (hasState)
+    {
+        xml.setAttribute("stateSize", (int)encodedPluginState.getSize());
+        xml.setAttribute("stateCompressed", pluginStateCompressed);
+    }
+
     copyXmlToBinary(xml, destData);
+
+    if (hasState)
+        destData.append(encodedPluginState.getData(), encodedPluginState.getSize());
 }
 
 void VST1BridgeProcessor::setStateInformation(const void* data, int sizeInBytes)
@@ -329,12 +1263,59 @@ void VST1BridgeProcessor::setStateInformation(const void* data, int sizeInBytes)
 
     if (xml && xml->hasTagName("VST1BridgeState"))
     {
+        if (xml->getBoolAttribute("isolated") != isolated)
+            setIsolated(!isolated);
+
+        setPipelinedProcessing(xml->getBoolAttribute("pipelined"));
+
         juce::String path = xml->getStringAttribute("pluginPath");
+        const int stateSize = xml->getIntAttribute("stateSize");
+
+        {
+            const juce::ScopedLock sl(stateLock);
+            pluginState.reset();
+            encodedPluginState.reset();
+            pluginStatePath = path;
+            pluginStatePending = false;
+            pluginStateGenerationValid = false;
+
+            if (path.isNotEmpty() && stateSize > 0 && stateSize < sizeInBytes)
+            {
+                auto* encoded = static_cast<const char*>(data) + sizeInBytes - stateSize;
+                pluginStateCompressed = xml->getBoolAttribute("stateCompressed");
+                encodedPluginState.replaceAll(encoded, (size_t)stateSize);
+
+                if (pluginStateCompressed)
+                {
+                    juce::MemoryInputStream source(encoded, (size_t)stateSize, false);
+                    juce::GZIPDecompressorInputStream gzip(source);
+                    gzip.readIntoMemoryBlock(pluginState);
+                }
+                else
+                {
+                    pluginState = encodedPluginState;
+                }
+
+                pluginStateHash = VST1Bridge::hashPluginState(pluginState.getData(), pluginState.getSize());
+
+                pluginStatePending = !pluginState.isEmpty();
+
+                if (!pluginStatePending)
+                    encodedPluginState.reset();
+            }
+        }
+
         if (path.isNotEmpty())
         {
             juce::File pluginFile(path);
+            // Session restore must not sit in effOpen on the host's thread
             if (pluginFile.existsAsFile())
-                loadVST1Plugin(pluginFile);
+                loadVST1PluginAsync(pluginFile);
+        }
+        else
+        {
+            // An empty state leaves nothing worth keeping a bridge for
+            unloadVST1Plugin();
         }
     }
 }
@@ -4,8 +4,14 @@
 #pragma once
 #include <JuceHeader.h>
 #include "BridgeProtocol.h"
+#include "BridgeSharedMemory.h"
+#include "BridgeDoorbell.h"
+#include "BridgeProcess.h"
+#include "RestoreCoordinator.h"
+#include "BridgedParameter.h"
 
-class VST1BridgeProcessor : public juce::AudioProcessor
+class VST1BridgeProcessor : public juce::AudioProcessor,
+                            private juce::Timer
 {
 public:
     VST1BridgeProcessor();
@@ -14,6 +20,10 @@ public:
     void prepareToPlay(double sampleRate, int samplesPerBlock) override;
     void releaseResources() override;
     void processBlock(juce::AudioBuffer<float>&, juce::MidiBuffer&) override;
+    void processBlock(juce::AudioBuffer<double>&, juce::MidiBuffer&) override;
+
+    // Double blocks go over the wire as doubles, to processDoubleReplacing where the plugin has it
+    bool supportsDoublePrecisionProcessing() const override { return true; }
 
     juce::AudioProcessorEditor* createEditor() override;
     bool hasEditor() const override { return true; }
@@ -21,7 +31,7 @@ public:
     const juce::String getName() const override { return "VST1 Bridge"; }
     bool acceptsMidi() const override { return true; }
     bool producesMidi() const override { return false; }
-    double getTailLengthSeconds() const override { return 0.0; }
+    double getTailLengthSeconds() const override;
 
     int getNumPrograms() override { return 1; }
     int getCurrentProgram() override { return 0; }
@@ -33,27 +43,182 @@ public:
     void setStateInformation(const void* data, int sizeInBytes) override;
 
     // VST1 Plugin Management
+    enum class LoadState
+    {
+        Idle,
+        StartingBridge,
+        LoadingPlugin,
+        Loaded,
+        Failed,
+        Cancelled
+    };
+
+    // Blocks until the bridge has answered; prefer loadVST1PluginAsync on the message thread
     bool loadVST1Plugin(const juce::File& dllFile);
+
+    // Loads on a background thread. onComplete is called on the message thread,
+    // unless the load was superseded by another load or the processor was deleted.
+    void loadVST1PluginAsync(const juce::File& dllFile, std::function<void(LoadState)> onComplete = nullptr);
+    void cancelPluginLoad();
+    LoadState getLoadState() const { return loadState; }
+
     void unloadVST1Plugin();
     bool isPluginLoaded() const { return pluginLoaded; }
-    juce::String getLoadedPluginPath() const { return loadedPluginPath; }
+    juce::String getLoadedPluginPath() const;
+    // AEffect::uniqueID of the loaded plugin, 0 when none is loaded
+    int32_t getLoadedPluginUniqueID() const { return loadedPluginUniqueID; }
+
+    // Isolated instances get a bridge process of their own instead of sharing one (applies on next load)
+    void setIsolated(bool shouldBeIsolated);
+    bool isIsolated() const { return isolated; }
+
+    // Parameter slots exposed to the host, whatever plugin is loaded
+    static constexpr int numBridgedParameters = VST1Bridge::kMaxBridgedParameters;
+
+    // Spin iterations before a block handoff falls back to a kernel wait (applies on next attach)
+    void setDoorbellSpinIterations(int iterations) { doorbellSpinIterations = iterations; }
+
+    // Submits each block without waiting for it and plays the previous block's result
+    // instead, so the bridge round trip overlaps the host's own work. Adds one block of
+    // latency, which is reported to the host.
+    void setPipelinedProcessing(bool shouldPipeline);
+    bool isPipelinedProcessing() const { return pipelined; }
+
+    // Applies an .fxp or .fxb to the loaded plugin in a single bridge transaction
+    bool loadPresetFile(const juce::File& presetFile);
+    // Writes the current program as an .fxp, or every program as an .fxb
+    bool savePresetFile(const juce::File& presetFile, bool asBank);
 
 private:
-    bool startBridgeProcess();
-    void stopBridgeProcess();
-    bool sendMessage(const VST1Bridge::MessageHeader& header, const void* data = nullptr);
-    bool receiveResponse(VST1Bridge::ResponseMessage& response);
+    class PluginLoadJob;
+
+    void timerCallback() override;
+
+    uint32_t beginPluginLoad(const juce::File& dllFile);
+    LoadState loadPlugin(const juce::File& dllFile, uint32_t sequence, const std::function<bool()>& shouldCancel);
+    void setLoadState(uint32_t sequence, LoadState state);
+    bool connectToBridge(const juce::String& architecture);
+    void disconnectFromBridge();
+    bool loadPluginInBridge(const juce::File& dllFile);
+    void unloadPluginInBridge();
+    void applyPlaybackSettings();
+    void sendPlaybackSettings();
+    bool sendBatch(const CommandBatch& batch);
+    void refreshParameterInfo();
+    void queueParameterChanges(VST1Bridge::SharedParameterQueue& queue);
+    bool sendRequest(VST1Bridge::MessageType type, const void* data, uint32_t dataSize,
+        VST1Bridge::ResponseMessage& response, int timeoutMs = 2000);
+    bool sendRequest(VST1Bridge::MessageType type, const void* data = nullptr, uint32_t dataSize = 0);
+    bool attachSharedAudio(int maxSamples);
+    bool sharedAudioMatchesSettings() const;
+    template <typename SampleType>
+    void processSamples(juce::AudioBuffer<SampleType>& buffer, juce::MidiBuffer& midiMessages);
+    template <typename SampleType>
+    int submitBlock(const VST1Bridge::SharedAudioView& audio, const juce::AudioBuffer<SampleType>& buffer,
+        const juce::MidiBuffer& midiMessages, int numInputs, int numOutputs);
+    template <typename SampleType>
+    void readBlockOutput(const VST1Bridge::SharedAudioView& audio, int slot, SampleType* const* dest,
+        int numOutputs, int numSamples) const;
+    bool waitForBlocksDone(uint32_t numBlocks);
+    void captureTimeInfo(VST1Bridge::SharedTimeInfo& info);
+    template <typename SampleType>
+    void processPipelined(const VST1Bridge::SharedAudioView& audio, juce::AudioBuffer<SampleType>& buffer,
+        const juce::MidiBuffer& midiMessages, int numInputs, int numOutputs);
+    void resetPipeline();
+    void updateLatency();
+    void readPluginDelays(const VST1Bridge::SharedAudioView& audio);
+    void setPluginDelays(int latency, int tail);
+    juce::String createStateRegionName();
+    bool receiveFromBridge(VST1Bridge::MessageType type, VST1Bridge::StateTransferMessage& msg, juce::MemoryBlock& dest);
+    bool sendToBridge(VST1Bridge::MessageType type, const juce::MemoryBlock& bytes, VST1Bridge::ResponseMessage& response);
+    bool fetchPluginState(juce::MemoryBlock& dest, uint64_t knownHash);
+    bool applyPluginState(const juce::MemoryBlock& state);
+    void refreshPluginState();
+
+    // Held for every change to the bridge connection; loads hold it for their whole duration
+    juce::CriticalSection bridgeLock;
+    // Taken by processBlock with a try-lock, and by anything that remaps the shared audio region
+    juce::CriticalSection audioLock;
+    // Guards the strings below, which the message thread reads while a load runs
+    juce::CriticalSection stateLock;
+
+    BridgeProcess::Ptr bridge;
+    uint32_t instanceId = 0;
+    std::atomic<bool> isolated { false };
+    juce::String isolationGroup;
+
+    std::atomic<LoadState> loadState { LoadState::Idle };
+    // Bumped under stateLock by every load and cancel. Only the load holding the current
+    // number may write loadState and pendingPluginPath.
+    std::atomic<uint32_t> loadSequence { 0 };
+    std::atomic<bool> preparePending { false };
+    juce::String pendingPluginPath;
+
+    VST1Bridge::SharedMemoryRegion sharedAudio;
+    int sharedAudioGeneration = 0;
+    VST1Bridge::Doorbell blockReady, blockDone;
+    int doorbellSpinIterations = VST1Bridge::kDefaultDoorbellSpinIterations;
+    uint32_t blocksSubmitted = 0;
+
+    // Pipelined mode: a delay line of pipelineLatencySamples between the bridge's output and ours
+    std::atomic<bool> pipelined { false };
+    int pipelineLatencySamples = 0;
+    bool pipelinePrimed = false;
+    juce::AbstractFifo pipelineFifo { 1 };
+
+    template <typename SampleType>
+    struct PipelineBuffers
+    {
+        juce::AudioBuffer<SampleType> output, scratch;
+
+        // The delay line has to hold a second block while it drains
+        void setSize(int numChannels, int latencySamples)
+        {
+            output.setSize(numChannels, 2 * latencySamples + 1);
+            scratch.setSize(numChannels, juce::jmax(1, latencySamples));
+        }
+    };
+
+    // Only the one matching the processing precision is allocated
+    PipelineBuffers<float> floatPipeline;
+    PipelineBuffers<double> doublePipeline;
 
-    juce::ChildProcess bridgeProcess;
-    std::unique_ptr<juce::NamedPipe> pipeToChild;
-    std::unique_ptr<juce::NamedPipe> pipeFromChild;
+    template <typename SampleType>
+    PipelineBuffers<SampleType>& getPipelineBuffers() noexcept
+    {
+        if constexpr (std::is_same_v<SampleType, double>)
+            return doublePipeline;
+        else
+            return floatPipeline;
+    }
 
-    juce::String pipeName;
-    bool pluginLoaded = false;
+    // As last published by the bridge
+    std::atomic<int> pluginLatencySamples { 0 };
+    std::atomic<int> pluginTailSamples { 0 };
+    VST1Bridge::AudioLayout audioLayout = VST1Bridge::AudioLayout::Interleaved;
+    std::atomic<bool> pluginLoaded { false };
     juce::String loadedPluginPath;
+    std::atomic<int32_t> loadedPluginUniqueID { 0 };
+    juce::Array<BridgedParameter*> bridgedParameters;   // owned by AudioProcessor
+    PendingParameterChanges pendingParameters;
 
-    juce::CriticalSection processLock;
-    uint32_t messageSequence = 0;
+    // The plugin's own state, under stateLock. pluginState is the bridge's raw capture,
+    // encodedPluginState the form it takes in the session, kept until the raw state changes.
+    juce::MemoryBlock pluginState, encodedPluginState;
+    uint64_t pluginStateHash = 0;
+    bool pluginStateCompressed = false;
+    // The bridge's stateGeneration when pluginState was last confirmed current
+    uint32_t pluginStateGeneration = 0;
+    bool pluginStateGenerationValid = false;
+    uint32_t pluginStateVerifiedMs = 0;
+    juce::String pluginStatePath;       // the plugin the state belongs to
+    bool pluginStatePending = false;    // restored from a session, applied by the next load
+    size_t stateCapacityHint = 0;
+    int stateRegionGeneration = 0;
+    uint32_t lastMirrorSequence = 0;
+    // What the timer collected from the mirror, passed on once it has let go of audioLock
+    juce::Array<VST1Bridge::SharedParameterChange> mirrorChanges;
 
+    JUCE_DECLARE_WEAK_REFERENCEABLE(VST1BridgeProcessor)
     JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(VST1BridgeProcessor)
 };
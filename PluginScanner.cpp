@@ -0,0 +1,395 @@
+// ==============================================================================
+// FILE: PluginScanner.cpp
+// ==============================================================================
+#include "PluginScanner.h"
+#include "BridgeProcess.h"
+
+JUCE_IMPLEMENT_SINGLETON(PluginScanner)
+
+namespace
+{
+    // How often a probe checks for cancellation while the plugin loads
+    constexpr int probePollMs = 100;
+    // Probes are killed within one poll of a cancel, this is only a backstop
+    constexpr int cancelTimeoutMs = 5000;
+    // Progress survives a host crash in the middle of a long scan
+    constexpr int saveIndexEveryProbes = 20;
+
+    const char* getResultName(PluginScanner::ProbeResult result)
+    {
+        switch (result)
+        {
+        case PluginScanner::ProbeResult::Ok:       return "ok";
+        case PluginScanner::ProbeResult::Crashed:  return "crashed";
+        case PluginScanner::ProbeResult::TimedOut: return "timedOut";
+        case PluginScanner::ProbeResult::Failed:
+        default:                                   return "failed";
+        }
+    }
+
+    PluginScanner::ProbeResult getResultFromName(const juce::String& name)
+    {
+        if (name == "ok")
+            return PluginScanner::ProbeResult::Ok;
+
+        if (name == "crashed")
+            return PluginScanner::ProbeResult::Crashed;
+
+        return name == "timedOut" ? PluginScanner::ProbeResult::TimedOut : PluginScanner::ProbeResult::Failed;
+    }
+}
+
+PluginScanner::PluginScanner()
+    : juce::Thread("VST1Bridge plugin scanner")
+{
+    loadIndex();
+}
+
+PluginScanner::~PluginScanner()
+{
+    stopThread(cancelTimeoutMs);
+    clearSingletonInstance();
+}
+
+juce::File PluginScanner::getIndexFile()
+{
+    return juce::File::getSpecialLocation(juce::File::userApplicationDataDirectory)
+        .getChildFile("VST1Bridge")
+        .getChildFile("PluginIndex.xml");
+}
+
+void PluginScanner::scan(const juce::Array<juce::File>& folders)
+{
+    cancelScan();
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto& folder : folders)
+            scannedFolders.addIfNotAlreadyThere(folder);
+    }
+
+    numProbed = 0;
+    numToProbe = 0;
+    numBlacklisted = 0;
+    scanStartMs = juce::Time::getMillisecondCounter();
+    scanEndMs = 0;
+    startThread(juce::Thread::Priority::background);
+}
+
+void PluginScanner::cancelScan()
+{
+    // Running probes notice within one poll and kill their processes
+    stopThread(cancelTimeoutMs);
+}
+
+PluginScanner::Progress PluginScanner::getProgress() const
+{
+    Progress progress;
+    progress.numProbed = numProbed;
+    progress.numToProbe = numToProbe;
+    progress.numBlacklisted = numBlacklisted;
+
+    const auto endMs = scanEndMs != 0 ? scanEndMs.load() : juce::Time::getMillisecondCounter();
+    progress.elapsedSeconds = scanStartMs != 0 ? (endMs - scanStartMs) / 1000.0 : 0.0;
+    return progress;
+}
+
+int PluginScanner::getNumBlacklisted() const
+{
+    const juce::ScopedLock sl(lock);
+    return (int)std::count_if(entries.begin(), entries.end(),
+        [](const auto& pathAndEntry) { return isBlacklisted(pathAndEntry.second.result); });
+}
+
+bool PluginScanner::isBlacklisted(const juce::File& dllFile) const
+{
+    const juce::ScopedLock sl(lock);
+    const auto it = entries.find(dllFile.getFullPathName());
+    return it != entries.end() && isBlacklisted(it->second.result);
+}
+
+void PluginScanner::clearBlacklist()
+{
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            if (isBlacklisted(it->second.result))
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    saveIndex();
+    sendChangeMessage();
+}
+
+std::vector<VST1Bridge::PluginDescription> PluginScanner::getPlugins() const
+{
+    std::vector<VST1Bridge::PluginDescription> plugins;
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto& [path, entry] : entries)
+            if (entry.result == ProbeResult::Ok)
+                plugins.push_back(entry.description);
+    }
+
+    std::sort(plugins.begin(), plugins.end(), [](const auto& a, const auto& b)
+        {
+            return a.name.compareNatural(b.name) < 0;
+        });
+
+    return plugins;
+}
+
+std::vector<PluginScanner::Entry> PluginScanner::getEntries() const
+{
+    std::vector<Entry> result;
+    const juce::ScopedLock sl(lock);
+
+    for (auto& [path, entry] : entries)
+        result.push_back(entry);
+
+    return result;
+}
+
+juce::Array<juce::File> PluginScanner::getScannedFolders() const
+{
+    const juce::ScopedLock sl(lock);
+    return scannedFolders;
+}
+
+void PluginScanner::run()
+{
+    const auto filesToProbe = findChangedFiles(getScannedFolders());
+    numToProbe = filesToProbe.size();
+    sendChangeMessage();
+
+    {
+        const int timeoutMs = probeTimeoutMs;
+        juce::ThreadPool pool(juce::jlimit(1, juce::jmax(1, filesToProbe.size()), numParallelProbes.load()));
+
+        for (auto& dllFile : filesToProbe)
+        {
+            pool.addJob([this, dllFile, timeoutMs]
+                {
+                    if (threadShouldExit())
+                        return;
+
+                    auto entry = probe(dllFile, timeoutMs);
+
+                    // Cancelled halfway through: neither a success nor the plugin's fault
+                    if (threadShouldExit())
+                        return;
+
+                    if (entry.has_value())
+                        addProbeResult(std::move(*entry));
+                    else
+                        --numToProbe;
+                });
+        }
+
+        // Only this thread writes the index
+        int numSaved = 0;
+
+        while (pool.getNumJobs() > 0 && !threadShouldExit())
+        {
+            wait(probePollMs);
+
+            if (numProbed - numSaved >= saveIndexEveryProbes)
+            {
+                numSaved = numProbed;
+                saveIndex();
+            }
+        }
+
+        pool.removeAllJobs(true, cancelTimeoutMs);
+    }
+
+    scanEndMs = juce::Time::getMillisecondCounter();
+    saveIndex();
+    sendChangeMessage();
+
+    const auto progress = getProgress();
+    DBG("Plugin scan probed " + juce::String(progress.numProbed) + " of " + juce::String(progress.numToProbe)
+        + " DLLs in " + juce::String(progress.elapsedSeconds, 1) + " s ("
+        + juce::String(progress.getProbesPerSecond(), 1) + "/s), "
+        + juce::String(progress.numBlacklisted) + " blacklisted");
+}
+
+void PluginScanner::addProbeResult(Entry entry)
+{
+    if (isBlacklisted(entry.result))
+        ++numBlacklisted;
+
+    {
+        const juce::ScopedLock sl(lock);
+        entries[entry.description.path] = std::move(entry);
+    }
+
+    ++numProbed;
+    sendChangeMessage();
+}
+
+juce::Array<juce::File> PluginScanner::findChangedFiles(const juce::Array<juce::File>& folders)
+{
+    juce::Array<juce::File> changed;
+
+    {
+        // Forget DLLs that were deleted since the last scan
+        const juce::ScopedLock sl(lock);
+
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            const juce::File file(it->first);
+            const bool inScannedFolder = std::any_of(folders.begin(), folders.end(),
+                [&file](const juce::File& folder) { return file.isAChildOf(folder); });
+
+            if (inScannedFolder && !file.existsAsFile())
+                it = entries.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    for (auto& folder : folders)
+    {
+        for (const auto& item : juce::RangedDirectoryIterator(folder, true, "*.dll"))
+        {
+            if (threadShouldExit())
+                return {};
+
+            const auto file = item.getFile();
+            const auto size = item.getFileSize();
+            const auto modified = item.getModificationTime().toMilliseconds();
+
+            const juce::ScopedLock sl(lock);
+            const auto it = entries.find(file.getFullPathName());
+
+            // A blacklisted DLL that changed, e.g. an update, gets another chance
+            if (it == entries.end()
+                || it->second.fileSize != size || it->second.modificationTime != modified)
+                changed.addIfNotAlreadyThere(file);
+        }
+    }
+
+    return changed;
+}
+
+// Nothing if the probe process never ran: that says nothing about the DLL, and a
+// recorded result would keep it from being probed again until it changes
+std::optional<PluginScanner::Entry> PluginScanner::probe(const juce::File& dllFile, int timeoutMs)
+{
+    Entry entry;
+    entry.description.path = dllFile.getFullPathName();
+    entry.fileSize = dllFile.getSize();
+    entry.modificationTime = dllFile.getLastModificationTime().toMilliseconds();
+
+    const auto executable = BridgeProcess::getExecutableFor(BridgeProcess::getArchitectureOf(dllFile));
+    // Unique without touching the disk, probes run in parallel
+    const auto resultFile = juce::File::getSpecialLocation(juce::File::tempDirectory)
+        .getChildFile("VST1BridgeProbe_" + juce::Uuid().toString() + ".xml");
+
+    // The probe's own output is of no interest, and an unread pipe could stall it
+    juce::ChildProcess process;
+
+    if (!executable.existsAsFile()
+        || !process.start(juce::StringArray { executable.getFullPathName(), "--probe",
+                                              entry.description.path, resultFile.getFullPathName() }, 0))
+    {
+        DBG("Could not start a probe for " + entry.description.path + " with " + executable.getFullPathName());
+        return std::nullopt;
+    }
+
+    const auto deadline = juce::Time::getMillisecondCounter() + (juce::uint32)timeoutMs;
+
+    while (!process.waitForProcessToFinish(probePollMs))
+    {
+        if (threadShouldExit() || juce::Time::getMillisecondCounter() >= deadline)
+        {
+            process.kill();
+            resultFile.deleteFile();
+            entry.result = ProbeResult::TimedOut;
+            return entry;
+        }
+    }
+
+    const auto exitCode = process.getExitCode();
+    auto xml = juce::parseXML(resultFile);
+    resultFile.deleteFile();
+
+    // Says nothing about the plugin either, e.g. a full temp drive
+    if (exitCode == (juce::uint32)VST1Bridge::kProbeExitNoResult)
+    {
+        DBG("Probe of " + entry.description.path + " could not write its result");
+        return std::nullopt;
+    }
+
+    if (exitCode == 0 && xml != nullptr && entry.description.readFrom(*xml))
+        entry.result = ProbeResult::Ok;
+    else
+        entry.result = exitCode == (juce::uint32)VST1Bridge::kProbeExitNotAPlugin ? ProbeResult::Failed : ProbeResult::Crashed;
+
+    return entry;
+}
+
+void PluginScanner::loadIndex()
+{
+    auto xml = juce::parseXML(getIndexFile());
+
+    if (xml == nullptr || !xml->hasTagName("VST1BridgePluginIndex"))
+        return;
+
+    const juce::ScopedLock sl(lock);
+
+    for (auto* folder : xml->getChildWithTagNameIterator("Folder"))
+        scannedFolders.addIfNotAlreadyThere(juce::File(folder->getStringAttribute("path")));
+
+    for (auto* plugin : xml->getChildWithTagNameIterator(VST1Bridge::PluginDescription::xmlTag))
+    {
+        Entry entry;
+        entry.description.readFrom(*plugin);
+        entry.fileSize = plugin->getStringAttribute("fileSize").getLargeIntValue();
+        entry.modificationTime = plugin->getStringAttribute("modified").getLargeIntValue();
+        entry.result = getResultFromName(plugin->getStringAttribute("result"));
+
+        if (entry.description.path.isNotEmpty())
+            entries[entry.description.path] = std::move(entry);
+    }
+}
+
+void PluginScanner::saveIndex() const
+{
+    juce::XmlElement xml("VST1BridgePluginIndex");
+    xml.setAttribute("version", 1);
+
+    {
+        const juce::ScopedLock sl(lock);
+
+        for (auto& folder : scannedFolders)
+            xml.createNewChildElement("Folder")->setAttribute("path", folder.getFullPathName());
+
+        for (auto& [path, entry] : entries)
+        {
+            auto* plugin = xml.createNewChildElement(VST1Bridge::PluginDescription::xmlTag);
+            entry.description.writeTo(*plugin);
+            plugin->setAttribute("fileSize", juce::String(entry.fileSize));
+            plugin->setAttribute("modified", juce::String(entry.modificationTime));
+            plugin->setAttribute("result", getResultName(entry.result));
+        }
+    }
+
+    const auto indexFile = getIndexFile();
+    indexFile.getParentDirectory().createDirectory();
+
+    // Written next to the index and moved over it, so a crash can't leave half a file
+    const auto tempFile = indexFile.getSiblingFile(indexFile.getFileName() + ".tmp");
+
+    if (xml.writeTo(tempFile))
+        tempFile.moveFileTo(indexFile);
+}
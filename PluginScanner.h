@@ -0,0 +1,105 @@
+// ==============================================================================
+// FILE: PluginScanner.h
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include <map>
+#include <optional>
+#include "PluginDescription.h"
+
+// Process-wide index of plugin DLLs. Each DLL is probed in a disposable bridge process
+// (VST1Bridge32.exe --probe), several at once, so a plugin that crashes or hangs while
+// loading never gets near a live session. Probes that crash or run past their deadline
+// are killed and blacklisted. The index is kept on disk, keyed by path, size and
+// modification time; a rescan only probes files that changed.
+class PluginScanner : public juce::ChangeBroadcaster,
+                      private juce::DeletedAtShutdown,
+                      private juce::Thread
+{
+public:
+    enum class ProbeResult
+    {
+        Ok,
+        Failed,     // loaded cleanly but is not a usable plugin
+        Crashed,
+        TimedOut
+    };
+
+    // Crashed and hung DLLs are not probed again until they change or the blacklist is cleared
+    static bool isBlacklisted(ProbeResult result)
+    {
+        return result == ProbeResult::Crashed || result == ProbeResult::TimedOut;
+    }
+
+    struct Entry
+    {
+        VST1Bridge::PluginDescription description;  // only the path unless the probe succeeded
+        juce::int64 fileSize = 0;
+        juce::int64 modificationTime = 0;
+        ProbeResult result = ProbeResult::Failed;
+    };
+
+    PluginScanner();
+    ~PluginScanner() override;
+
+    // Scans the folders recursively in the background and remembers them for rescans.
+    // Replaces a scan in progress.
+    void scan(const juce::Array<juce::File>& folders);
+    void rescan() { scan(getScannedFolders()); }
+    void cancelScan();
+
+    bool isScanning() const { return isThreadRunning(); }
+
+    struct Progress
+    {
+        int numProbed = 0;
+        int numToProbe = 0;
+        int numBlacklisted = 0;     // by the current scan
+        double elapsedSeconds = 0.0;
+
+        double getProbesPerSecond() const { return elapsedSeconds > 0.0 ? numProbed / elapsedSeconds : 0.0; }
+    };
+
+    // Of the current scan, or of the last one once it has finished
+    Progress getProgress() const;
+
+    // Probes running at once. Each is a process doing little but waiting on effOpen, so
+    // the default is one per core. Applies to the next scan.
+    void setNumParallelProbes(int numProbes) { numParallelProbes = juce::jmax(1, numProbes); }
+    // Applies to the next scan
+    void setProbeTimeoutMs(int timeoutMs) { probeTimeoutMs = juce::jmax(1000, timeoutMs); }
+
+    bool isBlacklisted(const juce::File& dllFile) const;
+    int getNumBlacklisted() const;
+    // Lets the next scan probe blacklisted DLLs again
+    void clearBlacklist();
+
+    // Plugins that loaded, sorted by name
+    std::vector<VST1Bridge::PluginDescription> getPlugins() const;
+    std::vector<Entry> getEntries() const;
+    juce::Array<juce::File> getScannedFolders() const;
+
+    static juce::File getIndexFile();
+
+    JUCE_DECLARE_SINGLETON(PluginScanner, false)
+
+private:
+    void run() override;
+    juce::Array<juce::File> findChangedFiles(const juce::Array<juce::File>& folders);
+    std::optional<Entry> probe(const juce::File& dllFile, int timeoutMs);
+    void addProbeResult(Entry entry);
+    void loadIndex();
+    void saveIndex() const;
+
+    mutable juce::CriticalSection lock;
+    std::map<juce::String, Entry> entries;      // by full path
+    juce::Array<juce::File> scannedFolders;
+
+    std::atomic<int> numParallelProbes { juce::SystemStats::getNumCpus() };
+    std::atomic<int> probeTimeoutMs { 20000 };
+
+    std::atomic<int> numProbed { 0 }, numToProbe { 0 }, numBlacklisted { 0 };
+    std::atomic<juce::uint32> scanStartMs { 0 }, scanEndMs { 0 };
+
+    JUCE_DECLARE_NON_COPYABLE(PluginScanner)
+};
@@ -0,0 +1,107 @@
+// ==============================================================================
+// FILE: PresetBrowser.cpp
+// ==============================================================================
+#include "PresetBrowser.h"
+
+namespace
+{
+    // A header read is quick, this only bounds a cancel in the middle of a huge folder
+    constexpr int stopTimeoutMs = 5000;
+}
+
+PresetBrowser::PresetBrowser()
+    : juce::Thread("VST1Bridge preset index")
+{
+}
+
+PresetBrowser::~PresetBrowser()
+{
+    stopThread(stopTimeoutMs);
+    cancelPendingUpdate();
+}
+
+void PresetBrowser::setDirectory(const juce::File& newDirectory, bool shouldRecurse)
+{
+    stopThread(stopTimeoutMs);
+    cancelPendingUpdate();
+
+    directory = newDirectory;
+    recursive = shouldRecurse;
+    startThread(juce::Thread::Priority::background);
+}
+
+void PresetBrowser::run()
+{
+    std::vector<Entry> found;
+
+    for (const auto& item : juce::RangedDirectoryIterator(directory, recursive, "*.fxp;*.fxb"))
+    {
+        if (threadShouldExit())
+            return;
+
+        found.push_back({ item.getFile() });
+    }
+
+    std::sort(found.begin(), found.end(), [](const Entry& a, const Entry& b)
+        {
+            return a.file.getFullPathName().compareNatural(b.file.getFullPathName()) < 0;
+        });
+
+    for (auto& entry : found)
+    {
+        if (threadShouldExit())
+            return;
+
+        juce::FileInputStream stream(entry.file);
+        entry.valid = stream.openedOk() && VST1Bridge::readFxPresetInfo(stream, entry.info);
+    }
+
+    {
+        const juce::ScopedLock sl(indexLock);
+        indexedEntries = std::move(found);
+    }
+
+    triggerAsyncUpdate();
+}
+
+void PresetBrowser::handleAsyncUpdate()
+{
+    {
+        const juce::ScopedLock sl(indexLock);
+        entries = std::move(indexedEntries);
+        indexedEntries.clear();
+    }
+
+    if (onIndexed != nullptr)
+        onIndexed();
+}
+
+juce::File PresetBrowser::getFile(int index) const
+{
+    return juce::isPositiveAndBelow(index, getNumPresets()) ? entries[(size_t)index].file : juce::File();
+}
+
+const VST1Bridge::FxPresetInfo* PresetBrowser::getInfo(int index) const
+{
+    if (!juce::isPositiveAndBelow(index, getNumPresets()))
+        return nullptr;
+
+    const auto& entry = entries[(size_t)index];
+    return entry.valid ? &entry.info : nullptr;
+}
+
+int PresetBrowser::findNext(int index, int32_t fxID, int direction) const
+{
+    const int numPresets = getNumPresets();
+
+    for (int step = 1; step <= numPresets; ++step)
+    {
+        const int candidate = ((index + step * direction) % numPresets + numPresets) % numPresets;
+
+        if (auto* info = getInfo(candidate))
+            if (fxID == 0 || info->fxID == fxID)
+                return candidate;
+    }
+
+    return -1;
+}
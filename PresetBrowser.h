@@ -0,0 +1,53 @@
+// ==============================================================================
+// FILE: PresetBrowser.h
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include "PresetFile.h"
+
+// A folder of .fxp and .fxb files. Opening it lists the directory and reads every
+// header on a background thread, so neither a big folder nor stepping through it
+// touches the disk on the message thread. Call it from the message thread only; the
+// finished index is swapped in there.
+class PresetBrowser : private juce::Thread,
+                      private juce::AsyncUpdater
+{
+public:
+    PresetBrowser();
+    ~PresetBrowser() override;
+
+    // Replaces the current index once the new folder has been read; onIndexed is called then
+    void setDirectory(const juce::File& newDirectory, bool recursive = true);
+    const juce::File& getDirectory() const { return directory; }
+    bool isIndexing() const { return isThreadRunning() || isUpdatePending(); }
+
+    std::function<void()> onIndexed;
+
+    int getNumPresets() const { return (int)entries.size(); }
+    juce::File getFile(int index) const;
+
+    // nullptr if the file is not a readable preset
+    const VST1Bridge::FxPresetInfo* getInfo(int index) const;
+
+    // The next preset after index in the given direction, wrapping around, that was saved
+    // by the plugin with this fxID. Pass 0 to accept any plugin. -1 if there is none.
+    int findNext(int index, int32_t fxID, int direction = 1) const;
+
+private:
+    struct Entry
+    {
+        juce::File file;
+        bool valid = false;
+        VST1Bridge::FxPresetInfo info;
+    };
+
+    void run() override;
+    void handleAsyncUpdate() override;
+
+    juce::File directory;
+    bool recursive = true;
+    std::vector<Entry> entries;
+
+    juce::CriticalSection indexLock;
+    std::vector<Entry> indexedEntries;  // handed from the thread to the message thread
+};
@@ -0,0 +1,249 @@
+// ==============================================================================
+// FILE: PresetFile.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include <vector>
+#include "pluginterfaces/vst2.x/vstfxstore.h"
+
+// Reader and writer for the SDK's .fxp (one program) and .fxb (bank) files.
+// Everything on disk is big-endian; the structs in vstfxstore.h only document the layout.
+namespace VST1Bridge {
+
+    // The fixed part in front of the parameters or chunk, enough to index a file
+    struct FxPresetInfo {
+        bool isBank = false;
+        bool isChunk = false;       // opaque effGetChunk data instead of parameter values
+        int32_t fxID = 0;
+        int32_t fxVersion = 0;
+        int32_t numEntries = 0;     // parameters of an .fxp, programs of an .fxb
+        int32_t currentProgram = -1; // version 2 banks only
+        juce::String name;          // program name, empty for banks
+    };
+
+    struct FxPresetProgram {
+        juce::String name;
+        std::vector<float> parameters;
+    };
+
+    struct FxPreset {
+        FxPresetInfo info;
+        std::vector<FxPresetProgram> programs; // one for a regular .fxp, one per program for a regular .fxb
+        juce::MemoryBlock chunk;
+    };
+
+    namespace FxPresetDetail {
+
+        constexpr int32_t programNameSize = 28;
+        // Corrupt headers must not turn into huge allocations
+        constexpr int32_t maxEntries = 1 << 16;
+        constexpr int32_t maxChunkSize = 256 * 1024 * 1024;
+
+        inline bool hasBytesLeft(juce::InputStream& in, int64_t numBytes)
+        {
+            return in.getTotalLength() < 0 || in.getNumBytesRemaining() >= numBytes;
+        }
+
+        inline bool readName(juce::InputStream& in, juce::String& name)
+        {
+            char buffer[programNameSize + 1] = {};
+
+            if (in.read(buffer, programNameSize) != programNameSize)
+                return false;
+
+            name = juce::String::fromUTF8(buffer);
+            return true;
+        }
+
+        inline void writeName(juce::OutputStream& out, const juce::String& name)
+        {
+            char buffer[programNameSize] = {};
+            name.copyToUTF8(buffer, programNameSize);
+            out.write(buffer, programNameSize);
+        }
+
+        inline bool readChunk(juce::InputStream& in, juce::MemoryBlock& chunk)
+        {
+            const auto size = in.readIntBigEndian();
+
+            if (size < 0 || size > maxChunkSize || !hasBytesLeft(in, size))
+                return false;
+
+            chunk.setSize((size_t)size);
+            return size == 0 || in.read(chunk.getData(), size) == size;
+        }
+
+        inline bool readParameters(juce::InputStream& in, int32_t numParams, std::vector<float>& dest)
+        {
+            if (numParams < 0 || numParams > maxEntries || !hasBytesLeft(in, 4 * (int64_t)numParams))
+                return false;
+
+            dest.resize((size_t)numParams);
+
+            for (auto& value : dest)
+                value = in.readFloatBigEndian();
+
+            return true;
+        }
+
+        // Bytes following an fxProgram's byteSize field
+        inline int32_t getProgramByteSize(bool isChunk, size_t numValues)
+        {
+            return 5 * 4 + programNameSize + (int32_t)(4 * numValues) + (isChunk ? 4 : 0);
+        }
+    }
+
+    // Reads the header of an .fxp or .fxb, leaving the stream at its content
+    inline bool readFxPresetInfo(juce::InputStream& in, FxPresetInfo& info)
+    {
+        if (in.readIntBigEndian() != cMagic)
+            return false;
+
+        in.readIntBigEndian(); // byteSize, not trusted
+        const auto fxMagic = in.readIntBigEndian();
+        const auto version = in.readIntBigEndian();
+
+        info.isBank = fxMagic == bankMagic || fxMagic == chunkBankMagic;
+        info.isChunk = fxMagic == chunkPresetMagic || fxMagic == chunkBankMagic;
+
+        if (!info.isBank && fxMagic != fMagic && fxMagic != chunkPresetMagic)
+            return false;
+
+        info.fxID = in.readIntBigEndian();
+        info.fxVersion = in.readIntBigEndian();
+        info.numEntries = in.readIntBigEndian();
+
+        if (info.numEntries < 0 || info.numEntries > FxPresetDetail::maxEntries)
+            return false;
+
+        if (!info.isBank)
+            return FxPresetDetail::readName(in, info.name);
+
+        // fxBank::future is 128 bytes, of which version 2 uses the first four
+        char future[128];
+
+        if (in.read(future, sizeof(future)) != (int)sizeof(future))
+            return false;
+
+        info.currentProgram = version >= 2 ? (int32_t)juce::ByteOrder::bigEndianInt(future) : -1;
+        return true;
+    }
+
+    inline bool readFxPreset(juce::InputStream& in, FxPreset& preset)
+    {
+        auto& info = preset.info;
+        preset.programs.clear();
+        preset.chunk.reset();
+
+        if (!readFxPresetInfo(in, info))
+            return false;
+
+        if (info.isChunk)
+        {
+            if (!info.isBank)
+                preset.programs.push_back({ info.name, {} });
+
+            return FxPresetDetail::readChunk(in, preset.chunk);
+        }
+
+        if (!info.isBank)
+        {
+            preset.programs.push_back({ info.name, {} });
+            return FxPresetDetail::readParameters(in, info.numEntries, preset.programs.back().parameters);
+        }
+
+        // Regular banks hold a complete fxProgram per program
+        for (int32_t i = 0; i < info.numEntries; ++i)
+        {
+            FxPresetInfo programInfo;
+
+            if (!readFxPresetInfo(in, programInfo) || programInfo.isBank || programInfo.isChunk)
+                return false;
+
+            preset.programs.push_back({ programInfo.name, {} });
+
+            if (!FxPresetDetail::readParameters(in, programInfo.numEntries, preset.programs.back().parameters))
+                return false;
+        }
+
+        return true;
+    }
+
+    inline bool writeFxPreset(juce::OutputStream& out, const FxPreset& preset)
+    {
+        using namespace FxPresetDetail;
+        const auto& info = preset.info;
+
+        auto writeProgram = [&out, &info](const FxPresetProgram& program)
+        {
+            out.writeIntBigEndian(cMagic);
+            out.writeIntBigEndian(getProgramByteSize(false, program.parameters.size()));
+            out.writeIntBigEndian(fMagic);
+            out.writeIntBigEndian(1);
+            out.writeIntBigEndian(info.fxID);
+            out.writeIntBigEndian(info.fxVersion);
+            out.writeIntBigEndian((int)program.parameters.size());
+            writeName(out, program.name);
+
+            for (auto value : program.parameters)
+                out.writeFloatBigEndian(value);
+        };
+
+        if (!info.isBank)
+        {
+            if (preset.programs.empty())
+                return false;
+
+            if (!info.isChunk)
+            {
+                writeProgram(preset.programs.front());
+                return true;
+            }
+
+            out.writeIntBigEndian(cMagic);
+            out.writeIntBigEndian(getProgramByteSize(true, 0) + (int32_t)preset.chunk.getSize());
+            out.writeIntBigEndian(chunkPresetMagic);
+            out.writeIntBigEndian(1);
+            out.writeIntBigEndian(info.fxID);
+            out.writeIntBigEndian(info.fxVersion);
+            out.writeIntBigEndian(info.numEntries);
+            writeName(out, preset.programs.front().name);
+            out.writeIntBigEndian((int)preset.chunk.getSize());
+            return out.write(preset.chunk.getData(), preset.chunk.getSize());
+        }
+
+        int32_t contentSize = 4 + (int32_t)preset.chunk.getSize();
+
+        if (!info.isChunk)
+        {
+            contentSize = 0;
+
+            for (auto& program : preset.programs)
+                contentSize += 8 + getProgramByteSize(false, program.parameters.size());
+        }
+
+        out.writeIntBigEndian(cMagic);
+        out.writeIntBigEndian(5 * 4 + 128 + contentSize);
+        out.writeIntBigEndian(info.isChunk ? chunkBankMagic : bankMagic);
+        out.writeIntBigEndian(2);
+        out.writeIntBigEndian(info.fxID);
+        out.writeIntBigEndian(info.fxVersion);
+        out.writeIntBigEndian(info.isChunk ? info.numEntries : (int)preset.programs.size());
+        out.writeIntBigEndian(info.currentProgram);
+
+        const char future[124] = {};
+        out.write(future, sizeof(future));
+
+        if (info.isChunk)
+        {
+            out.writeIntBigEndian((int)preset.chunk.getSize());
+            return out.write(preset.chunk.getData(), preset.chunk.getSize());
+        }
+
+        for (auto& program : preset.programs)
+            writeProgram(program);
+
+        return true;
+    }
+
+} // namespace VST1Bridge
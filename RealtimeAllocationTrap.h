@@ -0,0 +1,215 @@
+// ==============================================================================
+// FILE: RealtimeAllocationTrap.h (Shared between 64-bit and 32-bit processes)
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+#include <cstdlib>
+#include <new>
+
+// Debug aid: asserts when code running inside a ScopedRealtimeSection allocates
+// or frees. operator new/delete, aligned forms included, are trapped in binaries that
+// replace them (see VST1BRIDGE_DEFINE_ALLOCATION_TRAP). With the MSVC debug CRT a heap
+// hook also traps malloc, calloc, realloc and free, which is how juce::HeapBlock, and
+// so AudioBuffer and MemoryBlock, allocate; other builds don't see those. Set to 0 to
+// build without the trap.
+#ifndef VST1BRIDGE_TRAP_REALTIME_ALLOCATIONS
+ #define VST1BRIDGE_TRAP_REALTIME_ALLOCATIONS JUCE_DEBUG
+#endif
+
+#if VST1BRIDGE_TRAP_REALTIME_ALLOCATIONS && JUCE_MSVC && defined(_DEBUG)
+ #define VST1BRIDGE_TRAP_CRT_ALLOCATIONS 1
+ #include <crtdbg.h>
+#else
+ #define VST1BRIDGE_TRAP_CRT_ALLOCATIONS 0
+#endif
+
+#if JUCE_MSVC
+ #include <malloc.h>
+#endif
+
+namespace VST1Bridge {
+
+    struct RealtimeAllocationTrap
+    {
+        static bool& isArmedOnThisThread() noexcept
+        {
+            thread_local bool armed = false;
+            return armed;
+        }
+
+        static void check() noexcept
+        {
+            auto& armed = isArmedOnThisThread();
+
+            if (armed)
+            {
+                // Disarm while asserting, the assertion handler may allocate itself
+                armed = false;
+                jassertfalse; // Heap touched on the audio thread
+                armed = true;
+            }
+        }
+
+        // operator new/delete end up in malloc/free, where the heap hook already looks
+        static void checkNewDelete() noexcept
+        {
+           #if ! VST1BRIDGE_TRAP_CRT_ALLOCATIONS
+            check();
+           #endif
+        }
+
+        static void* allocateAligned(std::size_t size, std::size_t alignment) noexcept
+        {
+            size = juce::jmax(size, (std::size_t)1);
+
+           #if JUCE_MSVC
+            return _aligned_malloc(size, alignment);
+           #else
+            // aligned_alloc only takes whole multiples of the alignment
+            return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+           #endif
+        }
+
+        static void freeAligned(void* ptr) noexcept
+        {
+           #if JUCE_MSVC
+            _aligned_free(ptr);
+           #else
+            std::free(ptr);
+           #endif
+        }
+
+       #if VST1BRIDGE_TRAP_CRT_ALLOCATIONS
+        // Installed for as long as the module that defines the trap is loaded
+        class CrtHook
+        {
+        public:
+            CrtHook() noexcept    { getPrevious() = _CrtSetAllocHook(onHeapOperation); }
+            ~CrtHook() noexcept   { _CrtSetAllocHook(getPrevious()); }
+
+        private:
+            static _CRT_ALLOC_HOOK& getPrevious() noexcept
+            {
+                static _CRT_ALLOC_HOOK previous = nullptr;
+                return previous;
+            }
+
+            static int __cdecl onHeapOperation(int allocType, void* userData, size_t size, int blockType,
+                long requestNumber, const unsigned char* fileName, int lineNumber)
+            {
+                // The CRT's own bookkeeping blocks are not ours
+                if (blockType != _CRT_BLOCK)
+                    check();
+
+                auto* previous = getPrevious();
+                return previous != nullptr ? previous(allocType, userData, size, blockType, requestNumber, fileName, lineNumber)
+                                           : 1;
+            }
+        };
+       #endif
+    };
+
+    // Marks the current thread as real-time for the lifetime of this object
+    class ScopedRealtimeSection
+    {
+    public:
+       #if VST1BRIDGE_TRAP_REALTIME_ALLOCATIONS
+        ScopedRealtimeSection() noexcept : wasArmed(RealtimeAllocationTrap::isArmedOnThisThread())
+        {
+            RealtimeAllocationTrap::isArmedOnThisThread() = true;
+        }
+
+        ~ScopedRealtimeSection() noexcept
+        {
+            RealtimeAllocationTrap::isArmedOnThisThread() = wasArmed;
+        }
+
+    private:
+        const bool wasArmed;
+       #else
+        ScopedRealtimeSection() noexcept {}
+       #endif
+
+        JUCE_DECLARE_NON_COPYABLE(ScopedRealtimeSection)
+    };
+
+} // namespace VST1Bridge
+
+#if VST1BRIDGE_TRAP_CRT_ALLOCATIONS
+ #define VST1BRIDGE_DEFINE_CRT_ALLOCATION_HOOK() \
+    static VST1Bridge::RealtimeAllocationTrap::CrtHook vst1BridgeCrtAllocationHook;
+#else
+ #define VST1BRIDGE_DEFINE_CRT_ALLOCATION_HOOK()
+#endif
+
+// Replaces the global allocation functions with trapping versions, and hooks the CRT
+// heap where it can. Use once, at file scope, in exactly one translation unit of an
+// executable: the replacement applies to the whole process.
+#if VST1BRIDGE_TRAP_REALTIME_ALLOCATIONS
+ #define VST1BRIDGE_DEFINE_ALLOCATION_TRAP() \
+    VST1BRIDGE_DEFINE_CRT_ALLOCATION_HOOK() \
+    void* operator new(std::size_t size) \
+    { \
+        VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        if (auto* ptr = std::malloc(size > 0 ? size : 1)) \
+            return ptr; \
+        throw std::bad_alloc(); \
+    } \
+    void* operator new[](std::size_t size) { return operator new(size); } \
+    void* operator new(std::size_t size, const std::nothrow_t&) noexcept \
+    { \
+        VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        return std::malloc(size > 0 ? size : 1); \
+    } \
+    void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); } \
+    void* operator new(std::size_t size, std::align_val_t alignment) \
+    { \
+        VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        if (auto* ptr = VST1Bridge::RealtimeAllocationTrap::allocateAligned(size, (std::size_t)alignment)) \
+            return ptr; \
+        throw std::bad_alloc(); \
+    } \
+    void* operator new[](std::size_t size, std::align_val_t alignment) { return operator new(size, alignment); } \
+    void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept \
+    { \
+        VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        return VST1Bridge::RealtimeAllocationTrap::allocateAligned(size, (std::size_t)alignment); \
+    } \
+    void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t& tag) noexcept \
+    { \
+        return operator new(size, alignment, tag); \
+    } \
+    void operator delete(void* ptr) noexcept \
+    { \
+        if (ptr != nullptr) \
+            VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        std::free(ptr); \
+    } \
+    void operator delete[](void* ptr) noexcept { operator delete(ptr); } \
+    void operator delete(void* ptr, std::size_t) noexcept { operator delete(ptr); } \
+    void operator delete[](void* ptr, std::size_t) noexcept { operator delete(ptr); } \
+    void operator delete(void* ptr, const std::nothrow_t&) noexcept { operator delete(ptr); } \
+    void operator delete[](void* ptr, const std::nothrow_t&) noexcept { operator delete(ptr); } \
+    void operator delete(void* ptr, std::align_val_t) noexcept \
+    { \
+        if (ptr != nullptr) \
+            VST1Bridge::RealtimeAllocationTrap::checkNewDelete(); \
+        VST1Bridge::RealtimeAllocationTrap::freeAligned(ptr); \
+    } \
+    void operator delete[](void* ptr, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); } \
+    void operator delete(void* ptr, std::size_t, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); } \
+    void operator delete[](void* ptr, std::size_t, std::align_val_t alignment) noexcept { operator delete(ptr, alignment); } \
+    void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept { operator delete(ptr, alignment); } \
+    void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept { operator delete(ptr, alignment); }
+#else
+ #define VST1BRIDGE_DEFINE_ALLOCATION_TRAP()
+#endif
+
+// The same for a plugin module, which shares its process with the host and every other
+// plugin. A Windows DLL's operator new only covers the DLL itself; elsewhere the dynamic
+// linker would hand the replacement to the whole process, so the module goes without.
+#if JUCE_WINDOWS
+ #define VST1BRIDGE_DEFINE_MODULE_ALLOCATION_TRAP() VST1BRIDGE_DEFINE_ALLOCATION_TRAP()
+#else
+ #define VST1BRIDGE_DEFINE_MODULE_ALLOCATION_TRAP()
+#endif
@@ -0,0 +1,37 @@
+// ==============================================================================
+// FILE: RestoreCoordinator.cpp
+// ==============================================================================
+#include "RestoreCoordinator.h"
+
+JUCE_IMPLEMENT_SINGLETON(RestoreCoordinator)
+
+namespace
+{
+    // Loads mostly wait on the bridge, but each one can start a process and run
+    // an effOpen, so more workers than cores would only thrash
+    int getNumRestoreWorkers()
+    {
+        return juce::jlimit(2, 16, juce::SystemStats::getNumCpus());
+    }
+}
+
+RestoreCoordinator::RestoreCoordinator()
+    : pool(getNumRestoreWorkers())
+{
+}
+
+RestoreCoordinator::~RestoreCoordinator()
+{
+    pool.removeAllJobs(true, 30000);
+    clearSingletonInstance();
+}
+
+void RestoreCoordinator::addJob(juce::ThreadPoolJob* job)
+{
+    pool.addJob(job, true);
+}
+
+bool RestoreCoordinator::removeJobs(juce::ThreadPool::JobSelector& selector, int timeoutMs)
+{
+    return pool.removeAllJobs(true, timeoutMs, &selector);
+}
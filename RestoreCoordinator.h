@@ -0,0 +1,29 @@
+// ==============================================================================
+// FILE: RestoreCoordinator.h
+// ==============================================================================
+#pragma once
+#include <JuceHeader.h>
+
+// Process-wide worker pool for plugin loads. Opening a session restores every
+// instance at once; running those loads on a bounded pool lets bridge startup,
+// LoadPlugin and effOpen of independent instances overlap without spawning a
+// thread per instance.
+class RestoreCoordinator : private juce::DeletedAtShutdown
+{
+public:
+    RestoreCoordinator();
+    ~RestoreCoordinator() override;
+
+    // Takes ownership of the job
+    void addJob(juce::ThreadPoolJob* job);
+
+    // Interrupts and removes the selected jobs, waiting up to timeoutMs for running ones (-1: until they return)
+    bool removeJobs(juce::ThreadPool::JobSelector& selector, int timeoutMs);
+
+    JUCE_DECLARE_SINGLETON(RestoreCoordinator, false)
+
+private:
+    juce::ThreadPool pool;
+
+    JUCE_DECLARE_NON_COPYABLE(RestoreCoordinator)
+};
@@ -4,60 +4,59 @@
 // ==============================================================================
 #include <JuceHeader.h>
 #include "../BridgeProtocol.h"
+#include "../BridgeSharedMemory.h"
+#include "../BridgeDoorbell.h"
+#include "../RealtimeAllocationTrap.h"
+#include "../InterleaveKernels.h"
+#include "../PresetFile.h"
+#include "../PluginDescription.h"
+#include <deque>
+#include <iostream>
+#include <map>
 
 // VST SDK includes (you need to download VST 2.4 SDK)
 #include "pluginterfaces/vst2.x/aeffect.h"
 #include "pluginterfaces/vst2.x/aeffectx.h"
 
-class VST1BridgeApp
+VST1BRIDGE_DEFINE_ALLOCATION_TRAP()
+
+// One hosted AEffect with its own shared audio region and audio thread.
+// A bridge process holds as many of these as the host asks for.
+class PluginInstance
 {
 public:
-    VST1BridgeApp(const juce::String& pipeNameTo, const juce::String& pipeNameFrom)
+    PluginInstance()
     {
-        pipeIn = std::make_unique<juce::NamedPipe>();
-        pipeOut = std::make_unique<juce::NamedPipe>();
-
-        if (!pipeIn->openExisting(pipeNameTo) || !pipeOut->openExisting(pipeNameFrom))
-        {
-            DBG("Failed to connect to parent pipes");
-            return;
-        }
-
-        DBG("Bridge32 connected to parent process");
-        messageLoop();
+        prepareMidiEvents();
     }
 
-    ~VST1BridgeApp()
+    ~PluginInstance()
     {
+        detachSharedAudio();
         unloadPlugin();
     }
 
-private:
-    void messageLoop()
+    void handleMessage(VST1Bridge::MessageType type, const void* data, size_t dataSize,
+        VST1Bridge::ResponseMessage& response)
     {
-        while (true)
+        switch (type)
         {
-            VST1Bridge::MessageHeader header;
-            if (pipeIn->read(&header, sizeof(header), -1) != sizeof(header))
-                break;
-
-            handleMessage(header);
-        }
-    }
-
-    void handleMessage(const VST1Bridge::MessageHeader& header)
-    {
-        VST1Bridge::ResponseMessage response;
-        response.success = false;
-        response.errorMessage[0] = '\0';
+        case VST1Bridge::MessageType::Batch:
+            handleBatch(data, dataSize, response);
+            break;
 
-        switch (header.type)
-        {
         case VST1Bridge::MessageType::LoadPlugin:
         {
             VST1Bridge::LoadPluginMessage msg;
-            pipeIn->read(&msg, sizeof(msg), 1000);
+            if (!readPayload(data, dataSize, msg))
+                break;
+
+            msg.dllPath[sizeof(msg.dllPath) - 1] = '\0';
             response.success = loadPlugin(msg.dllPath);
+            response.pluginUniqueID = effect != nullptr ? effect->uniqueID : 0;
+            response.intValue = (int32_t)(msg.preferredLayout == VST1Bridge::AudioLayout::Planar
+                ? VST1Bridge::AudioLayout::Planar
+                : VST1Bridge::AudioLayout::Interleaved);
             break;
         }
 
@@ -69,10 +68,11 @@ private:
         case VST1Bridge::MessageType::SetSampleRate:
         {
             VST1Bridge::SetSampleRateMessage msg;
-            pipeIn->read(&msg, sizeof(msg), 1000);
-            if (effect)
+            if (effect && readPayload(data, dataSize, msg))
             {
+                hostConfig.sampleRate = msg.sampleRate;
                 dispatcher(effSetSampleRate, 0, 0, nullptr, (float)msg.sampleRate);
+                timeInfo.sampleRate = msg.sampleRate;
                 response.success = true;
             }
             break;
@@ -81,19 +81,35 @@ private:
         case VST1Bridge::MessageType::SetBlockSize:
         {
             VST1Bridge::SetBlockSizeMessage msg;
-            pipeIn->read(&msg, sizeof(msg), 1000);
-            if (effect)
+            if (effect && readPayload(data, dataSize, msg))
             {
+                hostConfig.maxBlockSize = msg.blockSize;
                 dispatcher(effSetBlockSize, 0, msg.blockSize, nullptr, 0.0f);
                 response.success = true;
             }
             break;
         }
 
+        case VST1Bridge::MessageType::SetIOConfiguration:
+        {
+            VST1Bridge::IOConfigurationMessage msg;
+            if (readPayload(data, dataSize, msg))
+            {
+                hostConfig.numInputs = msg.numInputs;
+                hostConfig.numOutputs = msg.numOutputs;
+                hostConfig.nonRealtime = msg.nonRealtime != 0;
+                response.success = true;
+            }
+            break;
+        }
+
         case VST1Bridge::MessageType::Resume:
             if (effect)
             {
+                applyProcessPrecision();
                 dispatcher(effMainsChanged, 0, 1, nullptr, 0.0f);
+                // initialDelay is only valid once resumed
+                publishPluginDelays();
                 response.success = true;
             }
             break;
@@ -106,28 +122,311 @@ private:
             }
             break;
 
-        case VST1Bridge::MessageType::ProcessAudio:
+        case VST1Bridge::MessageType::GetParameterCount:
+            if (effect)
+            {
+                response.intValue = effect->numParams;
+                response.success = true;
+            }
+            break;
+
+        case VST1Bridge::MessageType::GetParameter:
         {
-            response.success = processAudio(header);
-            return; // processAudio sends its own response
-        }
+            VST1Bridge::GetParameterMessage msg;
+            const juce::ScopedLock sl(effectLock);
+
+            if (!effect || !readPayload(data, dataSize, msg) || msg.index < 0 || msg.index >= effect->numParams)
+                break;
 
-        case VST1Bridge::MessageType::Shutdown:
+            response.paramValue = effect->getParameter(effect, msg.index);
             response.success = true;
-            sendResponse(response);
-            return;
+            break;
+        }
+
+        case VST1Bridge::MessageType::GetParameterInfo:
+        {
+            VST1Bridge::StateTransferMessage msg;
+            juce::MemoryBlock table;
+
+            if (readPayload(data, dataSize, msg) && captureParameterInfo(table))
+                copyToHostRegion(msg, table, response);
+            break;
+        }
+
+        case VST1Bridge::MessageType::SetParameter:
+        {
+            VST1Bridge::SetParameterMessage msg;
+            const juce::ScopedLock sl(effectLock);
+
+            if (effect && readPayload(data, dataSize, msg) && msg.index >= 0 && msg.index < effect->numParams)
+            {
+                effect->setParameter(effect, msg.index, msg.value);
+                storeInMirror(msg.index);
+                response.success = true;
+            }
+            break;
+        }
+
+        case VST1Bridge::MessageType::GetState:
+        {
+            VST1Bridge::StateTransferMessage msg;
+            juce::MemoryBlock state;
+
+            if (!readPayload(data, dataSize, msg) || !captureState(state))
+                break;
+
+            // The generation moved but the bytes didn't, e.g. a knob turned and back
+            if (msg.knownHash != 0 && VST1Bridge::hashPluginState(state.getData(), state.getSize()) == msg.knownHash)
+            {
+                response.intValue = 0;
+                response.success = true;
+                break;
+            }
+
+            copyToHostRegion(msg, state, response);
+            break;
+        }
+
+        case VST1Bridge::MessageType::SavePreset:
+        {
+            VST1Bridge::StateTransferMessage msg;
+            VST1Bridge::FxPreset preset;
+
+            if (!readPayload(data, dataSize, msg) || !capturePreset(msg.asBank != 0, preset))
+                break;
+
+            juce::MemoryOutputStream file;
+
+            if (VST1Bridge::writeFxPreset(file, preset))
+                copyToHostRegion(msg, file.getMemoryBlock(), response);
+            break;
+        }
+
+        case VST1Bridge::MessageType::LoadPreset:
+        {
+            VST1Bridge::StateTransferMessage msg;
+            VST1Bridge::SharedMemoryRegion region;
+
+            if (!readPayload(data, dataSize, msg) || msg.size <= 0)
+                break;
+
+            msg.regionName[sizeof(msg.regionName) - 1] = '\0';
+
+            if (!region.open(msg.regionName, (size_t)msg.size))
+                break;
+
+            juce::MemoryInputStream file(region.getData(), (size_t)msg.size, false);
+            VST1Bridge::FxPreset preset;
+
+            if (!VST1Bridge::readFxPreset(file, preset))
+                juce::String("Not an .fxp or .fxb file").copyToUTF8(response.errorMessage, sizeof(response.errorMessage));
+            else
+                response.success = applyPreset(preset, response);
+            break;
+        }
+
+        case VST1Bridge::MessageType::SetState:
+        {
+            VST1Bridge::StateTransferMessage msg;
+            VST1Bridge::SharedMemoryRegion region;
+
+            if (!readPayload(data, dataSize, msg) || msg.size <= 0)
+                break;
+
+            msg.regionName[sizeof(msg.regionName) - 1] = '\0';
+
+            if (region.open(msg.regionName, (size_t)msg.size))
+                response.success = applyState(region.getData(), (size_t)msg.size);
+            break;
+        }
+
+        case VST1Bridge::MessageType::AttachAudioBuffer:
+        {
+            VST1Bridge::AttachAudioBufferMessage msg;
+            if (!readPayload(data, dataSize, msg))
+                break;
+
+            msg.regionName[sizeof(msg.regionName) - 1] = '\0';
+            response.success = attachSharedAudio(msg);
+            break;
+        }
 
         default:
             break;
         }
+    }
+
+    // --probe mode: loads the plugin once and reports what it is
+    bool probe(const char* dllPath, VST1Bridge::PluginDescription& description)
+    {
+        const auto startMs = juce::Time::getMillisecondCounterHiRes();
+
+        if (!loadPlugin(dllPath))
+            return false;
+
+        const juce::ScopedLock sl(effectLock);
+
+        // Plenty of plugins ignore the SDK's string length limits
+        auto getString = [this](VstInt32 opcode)
+        {
+            char text[256] = {};
+            dispatcher(opcode, 0, 0, text, 0.0f);
+            text[sizeof(text) - 1] = '\0';
+            return juce::String::fromUTF8(text).trim();
+        };
+
+        static const char* const categoryNames[] = { "Unknown", "Effect", "Synth", "Analysis", "Mastering",
+            "Spacializer", "RoomFx", "SurroundFx", "Restoration", "OfflineProcess", "Shell", "Generator" };
+
+        const auto category = (int)dispatcher(effGetPlugCategory, 0, 0, nullptr, 0.0f);
+
+        description.loadTimeMs = juce::Time::getMillisecondCounterHiRes() - startMs;
+        description.path = dllPath;
+        description.name = getString(effGetEffectName);
+        description.vendor = getString(effGetVendorString);
+        description.product = getString(effGetProductString);
+        description.category = juce::isPositiveAndBelow(category, (int)std::size(categoryNames))
+            ? categoryNames[category] : categoryNames[0];
+        description.uniqueID = effect->uniqueID;
+        description.version = effect->version;
+        description.vendorVersion = (int32_t)dispatcher(effGetVendorVersion, 0, 0, nullptr, 0.0f);
+        description.vstVersion = (int32_t)dispatcher(effGetVstVersion, 0, 0, nullptr, 0.0f);
+        description.numInputs = effect->numInputs;
+        description.numOutputs = effect->numOutputs;
+        description.numParams = effect->numParams;
+        description.numPrograms = effect->numPrograms;
+        description.isSynth = (effect->flags & effFlagsIsSynth) != 0;
+        description.hasChunks = (effect->flags & effFlagsProgramChunks) != 0;
+
+        // VST 1.0 plugins have no effGetEffectName
+        if (description.name.isEmpty())
+            description.name = juce::File(dllPath).getFileNameWithoutExtension();
+
+        return true;
+    }
+
+    // Called from inside the plugin when its tail size needs asking for again. Whoever runs
+    // this instance's requests then calls refreshTailSize, once the plugin has returned.
+    std::function<void()> onTailSizeStale;
+
+    void refreshTailSize()
+    {
+        if (tailSizeStale.exchange(false))
+        {
+            const juce::ScopedLock sl(effectLock);
+            publishPluginDelays();
+        }
+    }
+
+private:
+    // Waits on the blockReady doorbell so the audio handshake never touches the pipes
+    class AudioThread : public juce::Thread
+    {
+    public:
+        explicit AudioThread(PluginInstance& o) : juce::Thread("VST1Bridge Audio"), owner(o) {}
+        ~AudioThread() override { stopThread(1000); }
+
+        void run() override
+        {
+            uint32_t processed = owner.blockReady.current();
+
+            while (!threadShouldExit())
+            {
+                if (!owner.blockReady.wait(processed, 100))
+                    continue;
+
+                // A pipelining host can be one block ahead, run every block it rang for
+                const VST1Bridge::ScopedRealtimeSection realtimeSection;
+
+                while (processed != owner.blockReady.current())
+                {
+                    owner.processAudio((int)(processed % (uint32_t)owner.numSlots));
+                    ++processed;
+                    owner.blockDone.ring();
+                }
+            }
+        }
+
+    private:
+        PluginInstance& owner;
+    };
+
+    // Runs each command of a Batch in order, collecting one status bit per command
+    void handleBatch(const void* data, size_t dataSize, VST1Bridge::ResponseMessage& response)
+    {
+        auto* bytes = static_cast<const char*>(data);
+        size_t offset = 0;
+        uint32_t statusBits = 0;
+        bool allSucceeded = true;
+
+        for (int i = 0; i < VST1Bridge::kMaxBatchCommands && offset < dataSize; ++i)
+        {
+            VST1Bridge::BatchCommandHeader command;
+
+            if (!readPayload(bytes + offset, dataSize - offset, command)
+                || sizeof(command) + command.dataSize > dataSize - offset
+                || command.type == VST1Bridge::MessageType::Batch)
+            {
+                allSucceeded = false;
+                break;
+            }
+
+            offset += sizeof(command);
+
+            VST1Bridge::ResponseMessage commandResponse;
+            commandResponse.success = false;
+            commandResponse.errorMessage[0] = '\0';
+            commandResponse.intValue = 0;
+            commandResponse.text[0] = '\0';
+            commandResponse.pluginUniqueID = 0;
+
+            handleMessage(command.type, command.dataSize > 0 ? bytes + offset : nullptr,
+                command.dataSize, commandResponse);
+            offset += command.dataSize;
+
+            if (commandResponse.success)
+                statusBits |= 1u << i;
+            else
+                allSucceeded = false;
+        }
+
+        response.success = allSucceeded && offset == dataSize;
+        response.intValue = (int32_t)statusBits;
+    }
 
-        sendResponse(response);
+    template <typename MessageStruct>
+    static bool readPayload(const void* data, size_t dataSize, MessageStruct& msg)
+    {
+        if (data == nullptr || dataSize < sizeof(msg))
+            return false;
+
+        std::memcpy(&msg, data, sizeof(msg));
+        return true;
+    }
+
+    // Loads of the same DLL are serialised: plenty of old plugins set up globals
+    // unguarded in their entry point and effOpen. Different DLLs load in parallel.
+    static juce::CriticalSection& getLoadLockFor(const juce::String& dllPath)
+    {
+        static juce::CriticalSection mapLock;
+        static std::map<juce::String, std::unique_ptr<juce::CriticalSection>> locks;
+
+        const juce::ScopedLock sl(mapLock);
+        auto& lock = locks[dllPath.toLowerCase()];
+
+        if (lock == nullptr)
+            lock = std::make_unique<juce::CriticalSection>();
+
+        return *lock;
     }
 
     bool loadPlugin(const char* dllPath)
     {
         unloadPlugin();
 
+        const juce::ScopedLock loadSl(getLoadLockFor(dllPath));
+        const juce::ScopedLock sl(effectLock);
+
         vstLib = std::make_unique<juce::DynamicLibrary>();
         if (!vstLib->open(dllPath))
         {
@@ -148,10 +447,13 @@ private:
             return false;
         }
 
+        // Callbacks made from inside the entry point can't be routed through resvd1 yet
+        loadingInstance = this;
         effect = mainProc(hostCallbackStatic);
         if (!effect || effect->magic != kEffectMagic)
         {
             DBG("Invalid VST plugin");
+            loadingInstance = nullptr;
             vstLib.reset();
             effect = nullptr;
             return false;
@@ -159,130 +461,1243 @@ private:
 
         // Store instance pointer for callback
         effect->resvd1 = (VstIntPtr)this;
+        loadingInstance = nullptr;
 
         dispatcher(effOpen, 0, 0, nullptr, 0.0f);
+        nextScanIndex = 0;
+        initialiseParameterMirror();
+        publishPluginDelays();
 
         DBG("VST1 plugin loaded successfully");
         return true;
     }
 
-    void unloadPlugin()
+    bool attachSharedAudio(const VST1Bridge::AttachAudioBufferMessage& msg)
     {
-        if (effect)
+        detachSharedAudio();
+
+        juce::String regionName(msg.regionName);
+
+        if (msg.numSlots < 1 || msg.numSlots > VST1Bridge::kMaxPipelineSlots
+            || !sharedAudio.open(regionName, VST1Bridge::getSharedAudioSize(msg.maxChannels, msg.maxSamples,
+                                                                            msg.numSlots, msg.sampleSize)))
+            return false;
+
+        auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+
+        if (!audio.isValid() || audio.getNumSlots() != msg.numSlots || (int32_t)audio.header->sampleSize != msg.sampleSize
+            || !blockReady.open(audio.header->blockReady, regionName + "_ready")
+            || !blockDone.open(audio.header->blockDone, regionName + "_done"))
         {
-            dispatcher(effMainsChanged, 0, 0, nullptr, 0.0f);
-            dispatcher(effClose, 0, 0, nullptr, 0.0f);
-            effect = nullptr;
+            detachSharedAudio();
+            return false;
         }
-        vstLib.reset();
-    }
 
-    VstIntPtr dispatcher(VstInt32 opcode, VstInt32 index, VstIntPtr value, void* ptr, float opt)
-    {
-        if (!effect || !effect->dispatcher)
-            return 0;
-        return effect->dispatcher(effect, opcode, index, value, ptr, opt);
+        blockReady.setSpinIterations(msg.spinIterations);
+        blockDone.setSpinIterations(msg.spinIterations);
+        prepareScratchBuffers(audio);
+
+        parameterMirror = &audio.header->parameterMirror;
+        stateGeneration = &audio.header->stateGeneration;
+        initialiseParameterMirror();
+        publishPluginDelays();
+
+        audioThread = std::make_unique<AudioThread>(*this);
+        audioThread->startThread(juce::Thread::Priority::highest);
+        return true;
     }
 
-    static VstIntPtr VSTCALLBACK hostCallbackStatic(AEffect* effect, VstInt32 opcode,
-        VstInt32 index, VstIntPtr value,
-        void* ptr, float opt)
+    // Everything processAudio needs is sized here, off the audio thread
+    void prepareScratchBuffers(const VST1Bridge::SharedAudioView& audio)
     {
-        VST1BridgeApp* instance = (VST1BridgeApp*)effect->resvd1;
-        return instance ? instance->hostCallback(opcode, index, value, ptr, opt) : 0;
+        const juce::ScopedLock sl(effectLock);
+
+        numChannels = (int)audio.header->maxChannels;
+        numSlots = audio.getNumSlots();
+
+        // Float scratch is also where a float-only plugin gets its converted double blocks
+        floatChannels.prepare(audio, numChannels, numSlots);
+
+        if (audio.holds<double>())
+            doubleChannels.prepare(audio, numChannels, numSlots);
+        else
+            doubleChannels.release();
     }
 
-    VstIntPtr hostCallback(VstInt32 opcode, VstInt32 index, VstIntPtr value, void* ptr, float opt)
+    // VstEvents ends in a two-entry array that plugins read past; size it for a full block
+    void prepareMidiEvents()
     {
-        switch (opcode)
+        midiEventStorage.calloc(VST1Bridge::kMaxMidiEventsPerBlock);
+        heldMidiEvents.calloc(VST1Bridge::kMaxMidiEventsPerBlock);
+        vstEventsStorage.calloc(sizeof(VstEvents) + (VST1Bridge::kMaxMidiEventsPerBlock - 2) * sizeof(VstEvent*));
+
+        auto* events = reinterpret_cast<VstEvents*>(vstEventsStorage.get());
+
+        for (int i = 0; i < VST1Bridge::kMaxMidiEventsPerBlock; ++i)
         {
-        case audioMasterVersion: return 2400;
-        case audioMasterCurrentId: return effect ? effect->uniqueID : 0;
-        case audioMasterGetSampleRate: return (VstIntPtr)44100;
-        case audioMasterGetBlockSize: return 512;
-        case audioMasterGetNumAudioIns: return 2;
-        case audioMasterGetNumAudioOuts: return 2;
-        default: return 0;
+            auto& midiEvent = midiEventStorage[i];
+            midiEvent.type = kVstMidiType;
+            midiEvent.byteSize = sizeof(VstMidiEvent);
+            events->events[i] = reinterpret_cast<VstEvent*>(&midiEvent);
         }
     }
 
-    bool processAudio(const VST1Bridge::MessageHeader& header)
+    // Keeps the events of a block that couldn't be processed for the next one, so a
+    // note-off never goes missing with it
+    void holdMidiEvents(const VST1Bridge::SharedBlockSlot& slot, int numEvents)
     {
-        VST1Bridge::ProcessAudioMessage msg;
-        pipeIn->read(&msg, sizeof(msg), 1000);
-
-        if (!effect)
-            return false;
+        numEvents = juce::jlimit(0, VST1Bridge::kMaxMidiEventsPerBlock, numEvents);
 
-        // Read interleaved audio data
-        juce::HeapBlock<float> audioData;
-        int dataSize = msg.numSamples * msg.numInputs;
-        audioData.allocate(dataSize, true);
+        for (int i = 0; i < numEvents && numHeldMidiEvents < VST1Bridge::kMaxMidiEventsPerBlock; ++i)
+        {
+            auto& held = heldMidiEvents[numHeldMidiEvents++];
+            held = slot.midiEvents[i];
+            held.deltaFrames = 0;
+        }
+    }
 
-        if (pipeIn->read(audioData, dataSize * sizeof(float), 2000) != dataSize * (int)sizeof(float))
-            return false;
+    void sendMidiEvents(const VST1Bridge::SharedBlockSlot& slot, int numEvents)
+    {
+        numEvents = juce::jlimit(0, VST1Bridge::kMaxMidiEventsPerBlock, numEvents);
 
-        // Prepare non-interleaved buffers for VST
-        juce::HeapBlock<float*> inputs, outputs;
-        juce::HeapBlock<float> inputBuffer, outputBuffer;
+        // Held events are already late and go first
+        const int numHeld = numHeldMidiEvents;
+        const int numToSend = juce::jmin(VST1Bridge::kMaxMidiEventsPerBlock, numHeld + numEvents);
+        numHeldMidiEvents = 0;
 
-        inputs.calloc(msg.numInputs);
-        outputs.calloc(msg.numOutputs);
-        inputBuffer.allocate(msg.numSamples * msg.numInputs, true);
-        outputBuffer.allocate(msg.numSamples * msg.numOutputs, true);
+        if (numToSend == 0)
+            return;
 
-        // Deinterleave input
-        for (int ch = 0; ch < msg.numInputs; ++ch)
+        for (int i = 0; i < numToSend; ++i)
         {
-            inputs[ch] = inputBuffer + (ch * msg.numSamples);
-            for (int i = 0; i < msg.numSamples; ++i)
-                inputs[ch][i] = audioData[i * msg.numInputs + ch];
+            const auto& source = i < numHeld ? heldMidiEvents[i] : slot.midiEvents[i - numHeld];
+            auto& midiEvent = midiEventStorage[i];
+            midiEvent.deltaFrames = source.deltaFrames;
+            std::memcpy(midiEvent.midiData, source.data, sizeof(midiEvent.midiData));
+
+            // Program changes switch the plugin's state from inside the audio stream
+            if ((source.data[0] & 0xf0) == 0xc0)
+                markStateChanged();
         }
 
-        for (int ch = 0; ch < msg.numOutputs; ++ch)
-            outputs[ch] = outputBuffer + (ch * msg.numSamples);
+        auto* events = reinterpret_cast<VstEvents*>(vstEventsStorage.get());
+        events->numEvents = numToSend;
+        events->reserved = 0;
+        dispatcher(effProcessEvents, 0, 0, events, 0.0f);
+    }
 
-        // Process
-        if (effect->flags & effFlagsCanReplacing)
-            effect->processReplacing(effect, inputs, outputs, msg.numSamples);
-        else
-            effect->process(effect, inputs, outputs, msg.numSamples);
+    // Seeds the mirror with the current values, without flagging them to the host
+    void initialiseParameterMirror()
+    {
+        const juce::ScopedLock sl(effectLock);
 
-        // Send response
-        VST1Bridge::ResponseMessage response;
-        response.success = true;
-        sendResponse(response);
+        auto* mirror = parameterMirror.load();
 
-        // Interleave and send output
-        for (int ch = 0; ch < msg.numOutputs; ++ch)
-            for (int i = 0; i < msg.numSamples; ++i)
-                audioData[i * msg.numOutputs + ch] = outputs[ch][i];
+        if (effect == nullptr || mirror == nullptr)
+            return;
 
-        pipeOut->write(audioData, msg.numSamples * msg.numOutputs * sizeof(float), 2000);
-        return true;
+        // Whatever the plugin announced while opening is not a user edit
+        mirror->collectDirty([](int32_t, float) {});
+
+        for (int i = 0; i < juce::jmin(effect->numParams, VST1Bridge::kMaxBridgedParameters); ++i)
+            storeInMirror(i);
     }
 
-    void sendResponse(const VST1Bridge::ResponseMessage& response)
+    // Records what the plugin made of a value the host set, so the scan won't echo it back
+    void storeInMirror(int index)
     {
-        VST1Bridge::MessageHeader header;
-        header.type = VST1Bridge::MessageType::Response;
-        header.dataSize = sizeof(response);
-        header.sequenceId = 0;
+        markStateChanged();
 
-        pipeOut->write(&header, sizeof(header), 1000);
-        pipeOut->write(&response, sizeof(response), 1000);
+        if (auto* mirror = parameterMirror.load())
+            mirror->store(index, effect->getParameter(effect, index));
     }
 
-    std::unique_ptr<juce::NamedPipe> pipeIn, pipeOut;
-    std::unique_ptr<juce::DynamicLibrary> vstLib;
-    AEffect* effect = nullptr;
-};
+    // Tells the host its cached state may be stale
+    void markStateChanged() noexcept
+    {
+        if (auto* generation = stateGeneration.load())
+            generation->fetch_add(1, std::memory_order_release);
+    }
+
+    // The whole bank chunk where the plugin has one, otherwise a snapshot of every parameter.
+    // Not under effectLock: a big chunk takes long enough to fail audio blocks, and plugins
+    // expect effGetChunk from a non-audio thread while they process. Only this instance's
+    // worker loads and unloads, so the effect can't go away underneath.
+    bool captureState(juce::MemoryBlock& dest)
+    {
+        if (!effect)
+            return false;
+
+        VST1Bridge::PluginStateHeader header;
+        header.magic = VST1Bridge::kPluginStateMagic;
+        header.uniqueID = effect->uniqueID;
+        header.currentProgram = (int32_t)dispatcher(effGetProgram, 0, 0, nullptr, 0.0f);
+
+        if (effect->flags & effFlagsProgramChunks)
+        {
+            void* chunk = nullptr;
+            const auto chunkSize = dispatcher(effGetChunk, 0, 0, &chunk, 0.0f);
+
+            if (chunk != nullptr && chunkSize > 0 && chunkSize < std::numeric_limits<int32_t>::max() - (VstIntPtr)sizeof(header))
+            {
+                header.format = VST1Bridge::PluginStateFormat::Chunk;
+                header.dataSize = (int32_t)chunkSize;
+
+                dest.setSize(sizeof(header) + (size_t)chunkSize);
+                std::memcpy(dest.getData(), &header, sizeof(header));
+                std::memcpy(static_cast<char*>(dest.getData()) + sizeof(header), chunk, (size_t)chunkSize);
+                return true;
+            }
+        }
+
+        const int numParams = juce::jmax(0, (int)effect->numParams);
+        header.format = VST1Bridge::PluginStateFormat::Parameters;
+        header.dataSize = numParams * (int32_t)sizeof(float);
+
+        dest.setSize(sizeof(header) + (size_t)header.dataSize);
+        std::memcpy(dest.getData(), &header, sizeof(header));
+        auto* values = reinterpret_cast<float*>(static_cast<char*>(dest.getData()) + sizeof(header));
+
+        for (int i = 0; i < numParams; ++i)
+            values[i] = effect->getParameter(effect, i);
+
+        return true;
+    }
+
+    // Names, labels and values of every mirrored parameter. The lock is taken per parameter,
+    // a plugin with a thousand of them would otherwise hold up audio for the whole table.
+    bool captureParameterInfo(juce::MemoryBlock& dest)
+    {
+        if (!effect)
+            return false;
+
+        const int numParams = juce::jlimit(0, (int)VST1Bridge::kMaxBridgedParameters, (int)effect->numParams);
+        dest.setSize((size_t)numParams * sizeof(VST1Bridge::ParameterInfoEntry), true);
+        auto* entries = static_cast<VST1Bridge::ParameterInfoEntry*>(dest.getData());
+
+        for (int i = 0; i < numParams; ++i)
+        {
+            const juce::ScopedLock sl(effectLock);
+
+            // kVstMaxParamStrLen is 8, but plenty of plugins write more
+            char text[256] = {};
+            dispatcher(effGetParamName, i, 0, text, 0.0f);
+            text[sizeof(text) - 1] = '\0';
+            juce::String(text).copyToUTF8(entries[i].name, sizeof(entries[i].name));
+
+            std::memset(text, 0, sizeof(text));
+            dispatcher(effGetParamLabel, i, 0, text, 0.0f);
+            text[sizeof(text) - 1] = '\0';
+            juce::String(text).copyToUTF8(entries[i].label, sizeof(entries[i].label));
+
+            entries[i].value = effect->getParameter(effect, i);
+        }
+
+        return true;
+    }
+
+    bool applyState(const void* data, size_t size)
+    {
+        const juce::ScopedLock sl(effectLock);
+
+        VST1Bridge::PluginStateHeader header;
+
+        if (!effect || !readPayload(data, size, header)
+            || header.magic != VST1Bridge::kPluginStateMagic
+            || header.uniqueID != effect->uniqueID
+            || header.dataSize < 0 || size - sizeof(header) < (size_t)header.dataSize)
+            return false;
+
+        auto* payload = static_cast<const char*>(data) + sizeof(header);
+
+        if (header.format == VST1Bridge::PluginStateFormat::Chunk)
+        {
+            if ((effect->flags & effFlagsProgramChunks) == 0)
+                return false;
+
+            // Plugins are allowed to keep the pointer, hand them a copy they can't scribble over
+            stateScratch.replaceAll(payload, (size_t)header.dataSize);
+            dispatcher(effSetChunk, 0, header.dataSize, stateScratch.getData(), 0.0f);
+        }
+        else
+        {
+            if (header.currentProgram >= 0 && header.currentProgram < effect->numPrograms)
+                dispatcher(effSetProgram, 0, header.currentProgram, nullptr, 0.0f);
+
+            auto* values = reinterpret_cast<const float*>(payload);
+            const int numValues = juce::jmin((int)effect->numParams, header.dataSize / (int)sizeof(float));
+
+            for (int i = 0; i < numValues; ++i)
+                effect->setParameter(effect, i, values[i]);
+        }
+
+        parametersReplaced();
+        return true;
+    }
+
+    // Everything may have moved, let the host's parameters and state cache follow
+    void parametersReplaced()
+    {
+        markStateChanged();
+
+        if (auto* mirror = parameterMirror.load())
+            for (int i = 0; i < juce::jmin(effect->numParams, VST1Bridge::kMaxBridgedParameters); ++i)
+                mirror->publish(i, effect->getParameter(effect, i));
+    }
+
+    // Answers GetState and SavePreset. Bytes that don't fit the host's region only report
+    // their size in intValue, so the host can retry with a bigger one.
+    static void copyToHostRegion(VST1Bridge::StateTransferMessage& msg, const juce::MemoryBlock& bytes,
+        VST1Bridge::ResponseMessage& response)
+    {
+        msg.regionName[sizeof(msg.regionName) - 1] = '\0';
+        response.intValue = (int32_t)bytes.getSize();
+
+        if ((size_t)msg.size < bytes.getSize())
+        {
+            response.success = true;
+            return;
+        }
+
+        VST1Bridge::SharedMemoryRegion region;
+
+        if (region.open(msg.regionName, bytes.getSize()))
+        {
+            std::memcpy(region.getData(), bytes.getData(), bytes.getSize());
+            response.success = true;
+        }
+    }
+
+    juce::String getCurrentProgramName()
+    {
+        // Plenty of plugins ignore kVstMaxProgNameLen
+        char name[256] = {};
+        dispatcher(effGetProgramName, 0, 0, name, 0.0f);
+        name[sizeof(name) - 1] = '\0';
+        return juce::String::fromUTF8(name);
+    }
+
+    // Reads like captureState, without effectLock, except for the steps of a bank walk
+    bool capturePreset(bool asBank, VST1Bridge::FxPreset& preset)
+    {
+        if (!effect)
+            return false;
+
+        auto& info = preset.info;
+        info.isBank = asBank;
+        info.fxID = effect->uniqueID;
+        info.fxVersion = effect->version;
+        info.currentProgram = (int32_t)dispatcher(effGetProgram, 0, 0, nullptr, 0.0f);
+
+        if (effect->flags & effFlagsProgramChunks)
+        {
+            void* chunk = nullptr;
+            const auto chunkSize = dispatcher(effGetChunk, asBank ? 0 : 1, 0, &chunk, 0.0f);
+
+            if (chunk != nullptr && chunkSize > 0 && chunkSize <= VST1Bridge::FxPresetDetail::maxChunkSize)
+            {
+                info.isChunk = true;
+                info.numEntries = asBank ? effect->numPrograms : effect->numParams;
+                preset.chunk.replaceAll(chunk, (size_t)chunkSize);
+
+                if (!asBank)
+                    preset.programs.push_back({ getCurrentProgramName(), {} });
+
+                return true;
+            }
+        }
+
+        auto readCurrentProgram = [this]
+        {
+            VST1Bridge::FxPresetProgram program { getCurrentProgramName(), {} };
+
+            for (int i = 0; i < effect->numParams; ++i)
+                program.parameters.push_back(effect->getParameter(effect, i));
+
+            return program;
+        };
+
+        if (!asBank)
+        {
+            info.numEntries = effect->numParams;
+            preset.programs.push_back(readCurrentProgram());
+            return true;
+        }
+
+        // A regular bank has to visit every program to read its values. Each visit switches
+        // back before letting go of the lock, so no block is processed with another program
+        // and an audio block waits for at most one visit. What the plugin automates while
+        // switching isn't an edit, and must not reach the host's parameters.
+        preset.programs.reserve((size_t)juce::jmax(0, (int)effect->numPrograms));
+
+        for (int i = 0; i < effect->numPrograms; ++i)
+        {
+            const juce::ScopedLock sl(effectLock);
+            walkingPrograms = true;
+
+            dispatcher(effSetProgram, 0, i, nullptr, 0.0f);
+            preset.programs.push_back(readCurrentProgram());
+            dispatcher(effSetProgram, 0, info.currentProgram, nullptr, 0.0f);
+
+            walkingPrograms = false;
+        }
+
+        info.numEntries = effect->numPrograms;
+        republishParameters();
+        return true;
+    }
+
+    // For plugins that don't come back exactly to where they were after a program walk
+    void republishParameters()
+    {
+        auto* mirror = parameterMirror.load();
+        bool changed = false;
+
+        if (mirror != nullptr)
+            for (int i = 0; i < juce::jmin(effect->numParams, VST1Bridge::kMaxBridgedParameters); ++i)
+                changed = mirror->publish(i, effect->getParameter(effect, i)) || changed;
+
+        if (changed)
+            markStateChanged();
+    }
+
+    // Applies an .fxp or .fxb one short step at a time under effectLock, like capturePreset:
+    // a parameter of a program, or a whole program of a bank, which is switched to and back
+    // before the lock is let go. A chunk is the one step the plugin can't split up.
+    bool applyPreset(const VST1Bridge::FxPreset& preset, VST1Bridge::ResponseMessage& response)
+    {
+        auto fail = [&response](const char* reason)
+        {
+            juce::String(reason).copyToUTF8(response.errorMessage, sizeof(response.errorMessage));
+            return false;
+        };
+
+        const auto& info = preset.info;
+
+        if (!effect)
+            return fail("No plugin loaded");
+
+        if (info.fxID != effect->uniqueID)
+            return fail("Preset belongs to another plugin");
+
+        if (info.isChunk && (effect->flags & effFlagsProgramChunks) == 0)
+            return fail("Plugin does not take chunks");
+
+        VstPatchChunkInfo patchInfo {};
+        patchInfo.version = 1;
+        patchInfo.pluginUniqueID = info.fxID;
+        patchInfo.pluginVersion = info.fxVersion;
+        patchInfo.numElements = info.numEntries;
+
+        {
+            const juce::ScopedLock sl(effectLock);
+
+            if (dispatcher(info.isBank ? effBeginLoadBank : effBeginLoadProgram, 0, 0, &patchInfo, 0.0f) == -1)
+                return fail("Plugin refused the preset");
+        }
+
+        // effectLock is recursive, a bank step holds it around all of this
+        auto applyProgram = [this](const VST1Bridge::FxPresetProgram& program)
+        {
+            {
+                const juce::ScopedLock sl(effectLock);
+                dispatcher(effBeginSetProgram, 0, 0, nullptr, 0.0f);
+            }
+
+            for (int i = 0; i < juce::jmin(effect->numParams, (int)program.parameters.size()); ++i)
+            {
+                const juce::ScopedLock sl(effectLock);
+                effect->setParameter(effect, i, program.parameters[(size_t)i]);
+            }
+
+            char name[kVstMaxProgNameLen + 1] = {};
+            program.name.copyToUTF8(name, sizeof(name));
+
+            const juce::ScopedLock sl(effectLock);
+            dispatcher(effSetProgramName, 0, 0, name, 0.0f);
+            dispatcher(effEndSetProgram, 0, 0, nullptr, 0.0f);
+        };
+
+        if (info.isChunk)
+        {
+            stateScratch.replaceAll(preset.chunk.getData(), preset.chunk.getSize());
+            const juce::ScopedLock sl(effectLock);
+
+            if (!info.isBank)
+                dispatcher(effBeginSetProgram, 0, 0, nullptr, 0.0f);
+
+            dispatcher(effSetChunk, info.isBank ? 0 : 1, (VstIntPtr)stateScratch.getSize(), stateScratch.getData(), 0.0f);
+
+            if (!info.isBank)
+                dispatcher(effEndSetProgram, 0, 0, nullptr, 0.0f);
+        }
+        else if (!info.isBank)
+        {
+            applyProgram(preset.programs.front());
+        }
+        else
+        {
+            const auto previousProgram = (int)dispatcher(effGetProgram, 0, 0, nullptr, 0.0f);
+            const int numPrograms = juce::jmin(effect->numPrograms, (int)preset.programs.size());
+
+            for (int i = 0; i < numPrograms; ++i)
+            {
+                const juce::ScopedLock sl(effectLock);
+                walkingPrograms = true;
+
+                dispatcher(effSetProgram, 0, i, nullptr, 0.0f);
+                applyProgram(preset.programs[(size_t)i]);
+                dispatcher(effSetProgram, 0, previousProgram, nullptr, 0.0f);
+
+                walkingPrograms = false;
+            }
+
+            const bool hasCurrent = info.currentProgram >= 0 && info.currentProgram < effect->numPrograms;
+            const juce::ScopedLock sl(effectLock);
+            dispatcher(effSetProgram, 0, hasCurrent ? info.currentProgram : previousProgram, nullptr, 0.0f);
+        }
+
+        parametersReplaced();
+        return true;
+    }
+
+    // Catches plugins that change values without calling audioMasterAutomate,
+    // a few parameters per block so the whole set is covered every few blocks
+    void scanParametersIntoMirror()
+    {
+        auto* mirror = parameterMirror.load();
+        const int numMirrored = juce::jmin(effect->numParams, VST1Bridge::kMaxBridgedParameters);
+
+        if (mirror == nullptr || numMirrored <= 0)
+            return;
+
+        for (int n = 0; n < juce::jmin(parameterScanSlice, numMirrored); ++n)
+        {
+            nextScanIndex = (nextScanIndex + 1) % numMirrored;
+
+            if (mirror->publish(nextScanIndex, effect->getParameter(effect, nextScanIndex)))
+                markStateChanged();
+        }
+    }
+
+    void detachSharedAudio()
+    {
+        parameterMirror = nullptr;
+        stateGeneration = nullptr;
+        audioThread.reset();
+        blockReady.close();
+        blockDone.close();
+        sharedAudio.close();
+    }
+
+    void unloadPlugin()
+    {
+        const juce::ScopedLock sl(effectLock);
+
+        if (effect)
+        {
+            dispatcher(effMainsChanged, 0, 0, nullptr, 0.0f);
+            dispatcher(effClose, 0, 0, nullptr, 0.0f);
+            effect = nullptr;
+        }
+        processingDouble = false;
+        vstLib.reset();
+        publishPluginDelays();
+    }
+
+    // The host picks these up from the shared region for delay compensation and bounces
+    void publishPluginDelays()
+    {
+        auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+
+        if (!audio.isValid())
+            return;
+
+        publishLatency();
+
+        // effGetTailSize answers 0 for "don't know" and 1 for "no tail"
+        const auto tail = (VstInt32)dispatcher(effGetTailSize, 0, 0, nullptr, 0.0f);
+        audio.header->pluginTailSamples.store(tail > 1 ? (int32_t)tail : 0, std::memory_order_release);
+    }
+
+    // Only reads AEffect, so it is safe from inside a call into the plugin
+    void publishLatency()
+    {
+        auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+
+        if (!audio.isValid())
+            return;
+
+        const auto latency = effect != nullptr ? effect->initialDelay : 0;
+        audio.header->pluginLatencySamples.store(juce::jmax(0, (int)latency), std::memory_order_release);
+    }
+
+    VstIntPtr dispatcher(VstInt32 opcode, VstInt32 index, VstIntPtr value, void* ptr, float opt)
+    {
+        if (!effect || !effect->dispatcher)
+            return 0;
+        return effect->dispatcher(effect, opcode, index, value, ptr, opt);
+    }
+
+    static VstIntPtr VSTCALLBACK hostCallbackStatic(AEffect* effect, VstInt32 opcode,
+        VstInt32 index, VstIntPtr value,
+        void* ptr, float opt)
+    {
+        auto* instance = effect != nullptr ? (PluginInstance*)effect->resvd1 : nullptr;
+
+        if (instance == nullptr)
+            instance = loadingInstance;
+
+        return instance ? instance->hostCallback(opcode, index, value, ptr, opt) : 0;
+    }
+
+    VstIntPtr hostCallback(VstInt32 opcode, VstInt32 index, VstIntPtr value, void* ptr, float opt)
+    {
+        switch (opcode)
+        {
+        case audioMasterVersion: return 2400;
+        case audioMasterAutomate:
+            if (walkingPrograms)
+                return 0;
+
+            markStateChanged();
+
+            if (auto* mirror = parameterMirror.load())
+                mirror->publish(index, opt);
+            return 0;
+        case audioMasterIOChanged:
+            // Sent from inside the plugin's own dispatcher or process call, and plenty of
+            // plugins aren't re-entrant: the tail size is asked for once it has returned
+            publishLatency();
+            tailSizeStale = true;
+
+            if (onTailSizeStale != nullptr)
+                onTailSizeStale();
+            return 1;
+        case audioMasterGetTime:
+            // The snapshot that came with the current block, no round trip to the host
+            return (VstIntPtr)&timeInfo;
+        case audioMasterCurrentId: return effect ? effect->uniqueID : 0;
+        case audioMasterGetSampleRate: return (VstIntPtr)hostConfig.sampleRate.load();
+        case audioMasterGetBlockSize: return (VstIntPtr)hostConfig.maxBlockSize.load();
+        case audioMasterGetInputLatency:
+        case audioMasterGetOutputLatency:
+            return 0;
+        case audioMasterGetCurrentProcessLevel: return getCurrentProcessLevel();
+        case audioMasterPinConnected:
+        {
+            // VST1 hosts report I/O this way; 0 means connected
+            const auto numPins = value == 0 ? hostConfig.numInputs.load() : hostConfig.numOutputs.load();
+            return index >= 0 && index < numPins ? 0 : 1;
+        }
+        case audioMasterGetVendorString: return copyHostString(ptr, "VST1Bridge", kVstMaxVendorStrLen);
+        case audioMasterGetProductString: return copyHostString(ptr, "VST1 Bridge", kVstMaxProductStrLen);
+        case audioMasterGetVendorVersion: return (VstIntPtr)VST1Bridge::kProtocolVersion;
+        case audioMasterCanDo: return canHostDo(static_cast<const char*>(ptr)) ? 1 : 0;
+        default: return 0;
+        }
+    }
+
+    VstIntPtr getCurrentProcessLevel() const
+    {
+        if (audioThread == nullptr || juce::Thread::getCurrentThread() != audioThread.get())
+            return kVstProcessLevelUser;
+
+        return hostConfig.nonRealtime ? kVstProcessLevelOffline : kVstProcessLevelRealtime;
+    }
+
+    static VstIntPtr copyHostString(void* dest, const char* text, size_t maxLength)
+    {
+        if (dest == nullptr)
+            return 0;
+
+        std::strncpy(static_cast<char*>(dest), text, maxLength - 1);
+        static_cast<char*>(dest)[maxLength - 1] = '\0';
+        return 1;
+    }
+
+    static bool canHostDo(const char* feature)
+    {
+        if (feature == nullptr)
+            return false;
+
+        for (auto* supported : { "sendVstEvents", "sendVstMidiEvent", "sendVstTimeInfo" })
+            if (std::strcmp(feature, supported) == 0)
+                return true;
+
+        return false;
+    }
+
+    // Called on the audio thread for each block the host has rung blockReady for
+    void processAudio(int slotIndex)
+    {
+        auto audio = VST1Bridge::SharedAudioView::fromRegion(sharedAudio);
+        auto& slot = audio.header->slots[slotIndex];
+        const auto msg = slot.block;
+        slot.blockSucceeded = 0;
+
+        // Never wait for a load/unload on the message loop: report a failed block instead
+        const juce::ScopedTryLock sl(effectLock);
+
+        if (!sl.isLocked())
+        {
+            holdMidiEvents(slot, msg.numMidiEvents);
+            return;
+        }
+
+        if (!effect || !audio.canHold(juce::jmax(msg.numInputs, msg.numOutputs), msg.numSamples))
+            return;
+
+        // Automation and events for this block go in before the audio call. A block that
+        // failed the try-lock left its changes queued, they go in with this one.
+        audio.header->parameterQueue.drain(msg.parameterQueueEnd, [this](const VST1Bridge::SharedParameterChange& change)
+            {
+                if (change.index >= 0 && change.index < effect->numParams)
+                {
+                    effect->setParameter(effect, change.index, change.value);
+                    storeInMirror(change.index);
+                }
+            });
+
+        // Plugins ask for the transport from inside processEvents as well
+        updateTimeInfo(slot.timeInfo);
+        sendMidiEvents(slot, msg.numMidiEvents);
+
+        if (!audio.holds<double>())
+            processBlockAs(floatChannels, audio, slotIndex, msg);
+        else if (processingDouble)
+            processBlockAs(doubleChannels, audio, slotIndex, msg);
+        else
+            processDoubleBlockInFloat(audio, slotIndex, msg);
+
+        scanParametersIntoMirror();
+
+        slot.blockSucceeded = 1;
+    }
+
+    // Channel tables for one sample type, sized off the audio thread
+    template <typename SampleType>
+    struct ChannelBuffers
+    {
+        juce::HeapBlock<SampleType*> inputs, outputs;               // scratch, for interleaved blocks
+        juce::HeapBlock<SampleType*> sharedInputs, sharedOutputs;   // numSlots runs of numChannels
+        juce::HeapBlock<SampleType> inputScratch, outputScratch;
+
+        void prepare(const VST1Bridge::SharedAudioView& audio, int numChannels, int numSlots)
+        {
+            const int maxSamples = (int)audio.header->maxSamples;
+
+            inputs.calloc(numChannels);
+            outputs.calloc(numChannels);
+            inputScratch.allocate(numChannels * maxSamples, true);
+            outputScratch.allocate(numChannels * maxSamples, true);
+
+            for (int ch = 0; ch < numChannels; ++ch)
+            {
+                inputs[ch] = inputScratch + (ch * maxSamples);
+                outputs[ch] = outputScratch + (ch * maxSamples);
+            }
+
+            sharedInputs.free();
+            sharedOutputs.free();
+
+            if (!audio.holds<SampleType>())
+                return;
+
+            sharedInputs.calloc(numSlots * numChannels);
+            sharedOutputs.calloc(numSlots * numChannels);
+
+            // Planar blocks are processed straight out of / into the shared region
+            for (int slot = 0; slot < numSlots; ++slot)
+            {
+                for (int ch = 0; ch < numChannels; ++ch)
+                {
+                    sharedInputs[slot * numChannels + ch] = audio.getInputChannel<SampleType>(slot, ch);
+                    sharedOutputs[slot * numChannels + ch] = audio.getOutputChannel<SampleType>(slot, ch);
+                }
+            }
+        }
+
+        void release()
+        {
+            inputs.free();
+            outputs.free();
+            sharedInputs.free();
+            sharedOutputs.free();
+            inputScratch.free();
+            outputScratch.free();
+        }
+    };
+
+    template <typename SampleType>
+    void processBlockAs(ChannelBuffers<SampleType>& channels, const VST1Bridge::SharedAudioView& audio,
+        int slotIndex, const VST1Bridge::ProcessAudioMessage& msg)
+    {
+        const bool planar = msg.layout == VST1Bridge::AudioLayout::Planar;
+        SampleType** inputs = planar ? channels.sharedInputs + slotIndex * numChannels : channels.inputs.get();
+        SampleType** outputs = planar ? channels.sharedOutputs + slotIndex * numChannels : channels.outputs.get();
+
+        // Interleaved blocks are deinterleaved into scratch first
+        if (!planar)
+            VST1Bridge::Interleave::deinterleave(audio.getInputs<SampleType>(slotIndex), inputs, msg.numInputs, msg.numSamples);
+
+        runEffect(inputs, outputs, msg.numOutputs, msg.numSamples);
+
+        if (!planar)
+            VST1Bridge::Interleave::interleave(outputs, audio.getOutputs<SampleType>(slotIndex), msg.numOutputs, msg.numSamples);
+    }
+
+    // Only ever written here, on the audio thread, before the plugin sees the block
+    void updateTimeInfo(const VST1Bridge::SharedTimeInfo& source)
+    {
+        const bool playing = (source.flags & VST1Bridge::kTimeInfoPlaying) != 0;
+        VstInt32 flags = playing != wasPlaying ? kVstTransportChanged : 0;
+        wasPlaying = playing;
+
+        if (playing)                                                flags |= kVstTransportPlaying;
+        if (source.flags & VST1Bridge::kTimeInfoRecording)          flags |= kVstTransportRecording;
+        if (source.flags & VST1Bridge::kTimeInfoLooping)            flags |= kVstTransportCycleActive;
+        if (source.flags & VST1Bridge::kTimeInfoPpqValid)           flags |= kVstPpqPosValid;
+        if (source.flags & VST1Bridge::kTimeInfoTempoValid)         flags |= kVstTempoValid;
+        if (source.flags & VST1Bridge::kTimeInfoBarValid)           flags |= kVstBarsValid;
+        if (source.flags & VST1Bridge::kTimeInfoLoopValid)          flags |= kVstCyclePosValid;
+        if (source.flags & VST1Bridge::kTimeInfoTimeSigValid)       flags |= kVstTimeSigValid;
+        if (source.flags & VST1Bridge::kTimeInfoSystemTimeValid)    flags |= kVstNanosValid;
+
+        timeInfo.samplePos = source.samplePosition;
+        timeInfo.sampleRate = source.sampleRate > 0 ? source.sampleRate : timeInfo.sampleRate;
+        timeInfo.nanoSeconds = source.systemTimeNanos;
+        timeInfo.ppqPos = source.ppqPosition;
+        timeInfo.tempo = source.tempo;
+        timeInfo.barStartPos = source.barStartPpq;
+        timeInfo.cycleStartPos = source.loopStartPpq;
+        timeInfo.cycleEndPos = source.loopEndPpq;
+        timeInfo.timeSigNumerator = source.timeSigNumerator;
+        timeInfo.timeSigDenominator = source.timeSigDenominator;
+        timeInfo.samplesToNextClock = 0;
+
+        // MIDI clock runs at 24 ticks per quarter note
+        if ((flags & kVstPpqPosValid) && (flags & kVstTempoValid) && timeInfo.tempo > 0)
+        {
+            const auto clocks = timeInfo.ppqPos * 24.0;
+            const auto samplesPerClock = timeInfo.sampleRate * 60.0 / (timeInfo.tempo * 24.0);
+            timeInfo.samplesToNextClock = (VstInt32)((std::ceil(clocks) - clocks) * samplesPerClock);
+            flags |= kVstClockValid;
+        }
+
+        timeInfo.flags = flags;
+    }
+
+    // A double-precision host with a float-only plugin: convert on this side, once each way
+    void processDoubleBlockInFloat(const VST1Bridge::SharedAudioView& audio, int slotIndex,
+        const VST1Bridge::ProcessAudioMessage& msg)
+    {
+        // Planar runs have a stride of 1, interleaved frames one of numChannels
+        const bool planar = msg.layout == VST1Bridge::AudioLayout::Planar;
+        const int inputStride = planar ? 1 : msg.numInputs;
+        const int outputStride = planar ? 1 : msg.numOutputs;
+
+        for (int ch = 0; ch < msg.numInputs; ++ch)
+        {
+            const auto* source = planar ? audio.getInputChannel<double>(slotIndex, ch)
+                                        : audio.getInputs<double>(slotIndex) + ch;
+            auto* input = floatChannels.inputs[ch];
+
+            for (int i = 0; i < msg.numSamples; ++i)
+                input[i] = (float)source[i * inputStride];
+        }
+
+        runEffect(floatChannels.inputs.get(), floatChannels.outputs.get(), msg.numOutputs, msg.numSamples);
+
+        for (int ch = 0; ch < msg.numOutputs; ++ch)
+        {
+            auto* dest = planar ? audio.getOutputChannel<double>(slotIndex, ch)
+                                : audio.getOutputs<double>(slotIndex) + ch;
+            const auto* output = floatChannels.outputs[ch];
+
+            for (int i = 0; i < msg.numSamples; ++i)
+                dest[i * outputStride] = output[i];
+        }
+    }
+
+    void runEffect(float** inputs, float** outputs, int numOutputs, int numSamples)
+    {
+        if (effect->flags & effFlagsCanReplacing)
+        {
+            effect->processReplacing(effect, inputs, outputs, numSamples);
+        }
+        else
+        {
+            // The legacy process() call accumulates into its outputs
+            for (int ch = 0; ch < numOutputs; ++ch)
+                juce::FloatVectorOperations::clear(outputs[ch], numSamples);
+
+            effect->process(effect, inputs, outputs, numSamples);
+        }
+    }
+
+    void runEffect(double** inputs, double** outputs, int /*numOutputs*/, int numSamples)
+    {
+        effect->processDoubleReplacing(effect, inputs, outputs, numSamples);
+    }
+
+    // Picks the precision matching the shared region; the plugin only accepts this while suspended
+    void applyProcessPrecision()
+    {
+        const juce::ScopedLock sl(effectLock);
+
+        if (!effect)
+            return;
+
+        const bool canDoubleReplacing = (effect->flags & effFlagsCanDoubleReplacing) != 0
+                                     && effect->processDoubleReplacing != nullptr;
+
+        processingDouble = canDoubleReplacing && VST1Bridge::SharedAudioView::fromRegion(sharedAudio).holds<double>();
+
+        if (canDoubleReplacing)
+            dispatcher(effSetProcessPrecision, 0,
+                processingDouble ? kVstProcessPrecision64 : kVstProcessPrecision32, nullptr, 0.0f);
+    }
+
+    VST1Bridge::SharedMemoryRegion sharedAudio;
+    VST1Bridge::Doorbell blockReady, blockDone;
+    std::unique_ptr<AudioThread> audioThread;
+    juce::CriticalSection effectLock;
+    ChannelBuffers<float> floatChannels;
+    ChannelBuffers<double> doubleChannels;
+    int numChannels = 0, numSlots = 1;
+    bool processingDouble = false;
+    VstTimeInfo timeInfo {};
+
+    // What the plugin is told about its host, kept current by the host's playback settings.
+    // Read from any thread inside hostCallback, so every field is atomic.
+    struct HostConfiguration
+    {
+        std::atomic<double> sampleRate { 44100.0 };
+        std::atomic<int32_t> maxBlockSize { 512 };
+        std::atomic<int32_t> numInputs { 2 };
+        std::atomic<int32_t> numOutputs { 2 };
+        std::atomic<bool> nonRealtime { false };
+    };
+
+    HostConfiguration hostConfig;
+    bool wasPlaying = false;
+    std::atomic<VST1Bridge::SharedParameterMirror*> parameterMirror { nullptr };
+    std::atomic<std::atomic<uint32_t>*> stateGeneration { nullptr };
+    int nextScanIndex = 0;
+    std::atomic<bool> walkingPrograms { false };    // a preset capture or load is visiting a bank's programs
+    std::atomic<bool> tailSizeStale { false };      // set by audioMasterIOChanged
+    static constexpr int parameterScanSlice = 8;
+    juce::MemoryBlock stateScratch;
+    juce::HeapBlock<VstMidiEvent> midiEventStorage;
+    juce::HeapBlock<VST1Bridge::SharedMidiEvent> heldMidiEvents;   // audio thread only
+    int numHeldMidiEvents = 0;
+    juce::HeapBlock<char> vstEventsStorage;
+    std::unique_ptr<juce::DynamicLibrary> vstLib;
+    AEffect* effect = nullptr;
+
+    static inline thread_local PluginInstance* loadingInstance = nullptr;
+
+    JUCE_DECLARE_NON_COPYABLE(PluginInstance)
+};
+
+class VST1BridgeApp
+{
+public:
+    VST1BridgeApp(const juce::String& pipeNameTo, const juce::String& pipeNameFrom)
+    {
+        pipeIn = std::make_unique<juce::NamedPipe>();
+        pipeOut = std::make_unique<juce::NamedPipe>();
+
+        if (!pipeIn->openExisting(pipeNameTo) || !pipeOut->openExisting(pipeNameFrom))
+        {
+            DBG("Failed to connect to parent pipes");
+            return;
+        }
+
+        DBG("Bridge32 connected to parent process");
+
+        if (!sendHello())
+            return;
+
+        messageLoop();
+    }
+
+private:
+    bool sendHello()
+    {
+        VST1Bridge::MessageHeader header;
+        header.type = VST1Bridge::MessageType::Hello;
+        header.dataSize = sizeof(VST1Bridge::HelloMessage);
+        header.sequenceId = 0;
+        header.instanceId = 0;
+
+        VST1Bridge::HelloMessage hello;
+        hello.protocolVersion = VST1Bridge::kProtocolVersion;
+        hello.capabilities = VST1Bridge::kCapabilitySharedAudio
+                           | VST1Bridge::kCapabilityPlanarAudio
+                           | VST1Bridge::kCapabilityMultiInstance;
+        hello.pointerSize = (uint32_t)sizeof(void*);
+
+        return pipeOut->write(&header, sizeof(header), 1000) == sizeof(header)
+            && pipeOut->write(&hello, sizeof(hello), 1000) == sizeof(hello);
+    }
+
+    // Runs one instance's requests in order on a thread of its own, so a slow
+    // effOpen in one instance never holds up requests for the others
+    class InstanceWorker : public juce::Thread
+    {
+    public:
+        InstanceWorker(VST1BridgeApp& a)
+            : juce::Thread("VST1Bridge Instance"), app(a), instance(std::make_unique<PluginInstance>())
+        {
+            instance->onTailSizeStale = [this] { queueChanged.signal(); };
+            startThread();
+        }
+
+        ~InstanceWorker() override
+        {
+            signalThreadShouldExit();
+            queueChanged.signal();
+            stopThread(instanceStopTimeoutMs);
+        }
+
+        // False once the instance has been destroyed, nothing would ever answer the request
+        bool post(const VST1Bridge::MessageHeader& header, juce::MemoryBlock&& payload)
+        {
+            {
+                const juce::ScopedLock sl(queueLock);
+
+                if (finished)
+                    return false;
+
+                queue.push_back({ header, std::move(payload) });
+            }
+
+            queueChanged.signal();
+            return true;
+        }
+
+        bool hasFinished() const noexcept { return finished; }
+
+        void run() override
+        {
+            while (!threadShouldExit())
+            {
+                // Outside any call into the plugin, which may have asked for this from inside one
+                instance->refreshTailSize();
+
+                Request request;
+                bool hasRequest = false;
+
+                {
+                    const juce::ScopedLock sl(queueLock);
+
+                    if (!queue.empty())
+                    {
+                        request = std::move(queue.front());
+                        queue.pop_front();
+                        hasRequest = true;
+                    }
+                }
+
+                if (!hasRequest)
+                {
+                    queueChanged.wait(-1);
+                    continue;
+                }
+
+                auto response = makeResponse();
+
+                if (request.header.type == VST1Bridge::MessageType::DestroyInstance)
+                {
+                    // effClose runs on the thread that ran effOpen
+                    instance.reset();
+                    response.success = true;
+                    app.sendResponse(request.header, response);
+
+                    // Requests that came in behind it fail now rather than time out in the host
+                    std::deque<Request> unanswered;
+
+                    {
+                        const juce::ScopedLock sl(queueLock);
+                        finished = true;
+                        unanswered.swap(queue);
+                    }
+
+                    for (auto& late : unanswered)
+                        app.sendResponse(late.header, makeResponse());
+
+                    return;
+                }
+
+                instance->handleMessage(request.header.type, request.payload.getData(),
+                    request.payload.getSize(), response);
+                app.sendResponse(request.header, response);
+            }
+        }
+
+    private:
+        struct Request
+        {
+            VST1Bridge::MessageHeader header;
+            juce::MemoryBlock payload;
+        };
+
+        VST1BridgeApp& app;
+        std::unique_ptr<PluginInstance> instance;
+        std::deque<Request> queue;
+        juce::CriticalSection queueLock;
+        juce::WaitableEvent queueChanged;
+        std::atomic<bool> finished { false };
+
+        JUCE_DECLARE_NON_COPYABLE(InstanceWorker)
+    };
+
+    // Long enough for a plugin that is still inside effOpen
+    static constexpr int instanceStopTimeoutMs = 30000;
+
+    static VST1Bridge::ResponseMessage makeResponse()
+    {
+        VST1Bridge::ResponseMessage response;
+        response.success = false;
+        response.errorMessage[0] = '\0';
+        response.intValue = 0;
+        response.text[0] = '\0';
+        response.pluginUniqueID = 0;
+        return response;
+    }
+
+    void messageLoop()
+    {
+        while (running)
+        {
+            VST1Bridge::MessageHeader header;
+            if (pipeIn->read(&header, sizeof(header), -1) != sizeof(header))
+                break;
+
+            handleMessage(header);
+            removeFinishedWorkers();
+        }
+
+        workers.clear();
+    }
+
+    void handleMessage(const VST1Bridge::MessageHeader& header)
+    {
+        juce::MemoryBlock payload;
+
+        if (header.dataSize > 0)
+        {
+            payload.setSize(header.dataSize);
+
+            if (pipeIn->read(payload.getData(), (int)header.dataSize, 1000) != (int)header.dataSize)
+            {
+                running = false;
+                return;
+            }
+        }
+
+        if (header.type == VST1Bridge::MessageType::Shutdown)
+        {
+            workers.clear();
+            running = false;
+
+            auto response = makeResponse();
+            response.success = true;
+            sendResponse(header, response);
+            return;
+        }
+
+        auto it = workers.find(header.instanceId);
+
+        if (it == workers.end())
+        {
+            // An instance starts with the attach of its audio region, or at the latest with a
+            // load. Anything else is for one that was destroyed, or never existed: a worker
+            // for it would only sit there until shutdown.
+            const bool startsInstance = header.type == VST1Bridge::MessageType::AttachAudioBuffer
+                                     || header.type == VST1Bridge::MessageType::LoadPlugin;
+
+            if (!startsInstance)
+            {
+                auto response = makeResponse();
+                response.success = header.type == VST1Bridge::MessageType::DestroyInstance;
+                sendResponse(header, response);
+                return;
+            }
+
+            it = workers.emplace(header.instanceId, std::make_unique<InstanceWorker>(*this)).first;
+        }
+
+        if (!it->second->post(header, std::move(payload)))
+            sendResponse(header, makeResponse());
+    }
+
+    void removeFinishedWorkers()
+    {
+        for (auto it = workers.begin(); it != workers.end();)
+        {
+            if (it->second->hasFinished())
+                it = workers.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    // Called from the instance workers as well as the message loop
+    void sendResponse(const VST1Bridge::MessageHeader& request, const VST1Bridge::ResponseMessage& response)
+    {
+        VST1Bridge::MessageHeader header;
+        header.type = VST1Bridge::MessageType::Response;
+        header.dataSize = sizeof(response);
+        header.sequenceId = request.sequenceId;
+        header.instanceId = request.instanceId;
+
+        const juce::ScopedLock sl(writeLock);
+        pipeOut->write(&header, sizeof(header), 1000);
+        pipeOut->write(&response, sizeof(response), 1000);
+    }
+
+    std::unique_ptr<juce::NamedPipe> pipeIn, pipeOut;
+    juce::CriticalSection writeLock;
+    std::map<uint32_t, std::unique_ptr<InstanceWorker>> workers;
+    bool running = true;
+};
+
+// Runs in a process of its own per plugin, so a plugin that crashes or hangs while
+// loading only takes the probe down. Writes one PluginDescription element on success;
+// a file rather than stdout, which plenty of plugins scribble on.
+static int probePlugin(const char* dllPath, const char* resultPath)
+{
+    VST1Bridge::PluginDescription description;
+
+    {
+        PluginInstance instance;
+
+        if (!instance.probe(dllPath, description))
+            return VST1Bridge::kProbeExitNotAPlugin;
+    }
+
+    juce::XmlElement xml(VST1Bridge::PluginDescription::xmlTag);
+    description.writeTo(xml);
+    return xml.writeTo(juce::File(resultPath)) ? 0 : VST1Bridge::kProbeExitNoResult;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc >= 2 && juce::String(argv[1]) == "--benchmark-interleave")
+    {
+        std::cout << VST1Bridge::Interleave::runBenchmark() << std::flush;
+        return 0;
+    }
+
+    if (argc >= 4 && juce::String(argv[1]) == "--probe")
+        return probePlugin(argv[2], argv[3]);
 
-int main(int argc, char* argv[])
-{
     if (argc < 3)
     {
-        DBG("Usage: VST1Bridge32.exe <pipeNameTo> <pipeNameFrom>");
+        DBG("Usage: VST1Bridge32.exe <pipeNameTo> <pipeNameFrom>, --probe <dll> <resultFile> or --benchmark-interleave");
         return 1;
     }
 